@@ -0,0 +1,691 @@
+/*******************************************************************************
+ *  Filename: sakura-bench.c
+ *  Description: Output throughput benchmark for sakura terminals
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ *****************************************************************************/
+
+/* The terminal is created by sakura itself, so the benchmark uses the same font,
+ * colors, match regexes, scrollback and line height than a normal tab. Build it
+ * with "make sakura-bench" and run it under Xvfb (xvfb-run ./src/sakura-bench) or
+ * with GDK_BACKEND=broadway and a running broadwayd. The results are written to
+ * the standard output as JSON.
+ *
+ * With --memory it opens tabs instead, filling their scrollback, and reports the
+ * process RSS and PSS with 1, 10, 100 and 500 tabs, next to the estimate shown in
+ * the tab tooltips */
+
+#include "../src/sakura.c"
+
+#define BENCH_DEFAULT_SIZE 32           /* MiB generated for each synthetic stream */
+#define BENCH_CHUNK_SIZE (64*1024)      /* Bytes fed at once, like a pty read */
+#define BENCH_END_MARKER "sakura-bench-end-%u"
+#define BENCH_DEFAULT_TABS "1,10,100,500"
+#define BENCH_DEFAULT_FILL 1000         /* Lines written to each tab in memory mode */
+
+struct bench_run {
+	gchar *name;
+	GBytes *data;
+	gsize offset;
+	gint64 start;                   /* Monotonic times, in microseconds */
+	gint64 end;
+	gint64 last_paint;
+	GArray *frames;                 /* Time between painted frames, in microseconds */
+};
+
+/* Memory used with some number of tabs open, in KiB */
+struct bench_memory {
+	guint tabs;
+	gsize rss;
+	gsize pss;
+	gsize estimate;                 /* Sum of the per tab estimates of sakura */
+};
+
+static struct {
+	struct sakura_tab *sk_tab;
+	GPtrArray *runs;
+	guint current;
+	gchar *marker;                  /* Title set at the end of the current run */
+	bool feeding;                   /* Waiting for vte to process a chunk */
+	guint idle_id;
+	bool started;
+	gchar **targets;                /* Memory mode: tab counts to measure */
+	guint target;
+	guint ntabs;
+	GBytes *fill;
+	gsize base_rss;
+	gsize base_pss;
+	GArray *memory;
+} bench;
+
+static gint option_size = BENCH_DEFAULT_SIZE;
+static gchar **option_streams;
+static gchar **option_replays;
+static gboolean option_memory;
+static gchar *option_tabs;
+static gint option_fill = BENCH_DEFAULT_FILL;
+
+static GOptionEntry bench_entries[] = {
+	{ "config-file", 0, 0, G_OPTION_ARG_FILENAME, &option_config_file, "Use alternate configuration file", NULL },
+	{ "stream", 's', 0, G_OPTION_ARG_STRING_ARRAY, &option_streams, "Synthetic stream: ascii, sgr, cjk, tui or long-lines (default all)", "NAME" },
+	{ "replay", 'r', 0, G_OPTION_ARG_FILENAME_ARRAY, &option_replays, "Replay a raw terminal output file or an asciicast (.cast, .cast.gz) recording", "FILE" },
+	{ "size", 0, 0, G_OPTION_ARG_INT, &option_size, "MiB generated for each synthetic stream", "MIB" },
+	{ "memory", 'm', 0, G_OPTION_ARG_NONE, &option_memory, "Measure the memory used by the tabs instead of the output speed", NULL },
+	{ "tabs", 0, 0, G_OPTION_ARG_STRING, &option_tabs, "Tab counts measured in memory mode (default " BENCH_DEFAULT_TABS ")", "N,N,..." },
+	{ "fill", 0, 0, G_OPTION_ARG_INT, &option_fill, "Lines written to each tab in memory mode", "LINES" },
+	{ NULL }
+};
+
+static const char *bench_words[] = {
+	"lorem", "ipsum", "dolor", "sit", "amet", "consectetur", "adipiscing", "elit",
+	"sed", "do", "eiusmod", "tempor", "incididunt", "ut", "labore", "et", "dolore"
+};
+
+static const char *bench_wide[] = {
+	"漢", "字", "日", "本", "語", "中", "文", "한", "국", "어", "桜", "端", "末", "🌸", "😀"
+};
+
+
+/* Printable ASCII lines, scrolling as fast as possible */
+static void
+bench_stream_ascii (GString *out, gsize size)
+{
+	guint line = 0;
+	int i;
+
+	while (out->len < size) {
+		for (i = 0; i < 79; i++)
+			g_string_append_c(out, ' ' + 1 + (line + i) % 94);
+		g_string_append(out, "\r\n");
+		line++;
+	}
+}
+
+
+/* Every word with its own foreground, background and attributes, like colored logs or ls */
+static void
+bench_stream_sgr (GString *out, gsize size)
+{
+	guint n = 0;
+
+	while (out->len < size) {
+		g_string_append_printf(out, "\033[%d;38;5;%u;48;5;%um%s\033[0m ",
+		                       n % 3 == 0 ? 1 : n % 3 == 1 ? 4 : 22,
+		                       n % 256, (n * 7 + 16) % 256, bench_words[n % G_N_ELEMENTS(bench_words)]);
+		if (++n % 10 == 0)
+			g_string_append(out, "\r\n");
+	}
+}
+
+
+/* Double width characters, with some emoji */
+static void
+bench_stream_cjk (GString *out, gsize size)
+{
+	guint n = 0;
+
+	while (out->len < size) {
+		g_string_append(out, bench_wide[n % G_N_ELEMENTS(bench_wide)]);
+		if (++n % 39 == 0)
+			g_string_append(out, "\r\n");
+	}
+}
+
+
+/* Full screen redraws with cursor addressing, like top or an editor scrolling */
+static void
+bench_stream_tui (GString *out, gsize size)
+{
+	guint frame = 0;
+	int row;
+
+	while (out->len < size) {
+		g_string_append(out, "\033[?25l\033[H\033[7m sakura-bench");
+		g_string_append_printf(out, "%*u \033[0m", 66, frame);
+		for (row = 2; row <= 24; row++) {
+			g_string_append_printf(out, "\033[%d;1H\033[38;5;%um%5u %-12s %8.1f%%\033[0m\033[K",
+			                       row, (frame + row) % 216 + 16, frame * 24 + row,
+			                       bench_words[(frame + row) % G_N_ELEMENTS(bench_words)],
+			                       (double) ((frame * 31 + row * 17) % 1000) / 10);
+			g_string_append_printf(out, "\033[%d;40H%s", row, bench_words[row % G_N_ELEMENTS(bench_words)]);
+		}
+		g_string_append(out, "\033[24;1H\033[?25h");
+		frame++;
+	}
+}
+
+
+/* Lines much longer than the terminal, wrapped by vte */
+static void
+bench_stream_long_lines (GString *out, gsize size)
+{
+	guint line = 0;
+	int i;
+
+	while (out->len < size) {
+		for (i = 0; i < 64*1024; i++)
+			g_string_append_c(out, 'a' + (line + i) % 26);
+		g_string_append(out, "\r\n");
+		line++;
+	}
+}
+
+
+static const struct {
+	const char *name;
+	void (*generate)(GString *, gsize);
+} bench_streams[] = {
+	{ "ascii", bench_stream_ascii },
+	{ "sgr", bench_stream_sgr },
+	{ "cjk", bench_stream_cjk },
+	{ "tui", bench_stream_tui },
+	{ "long-lines", bench_stream_long_lines },
+};
+
+
+/* Decode the JSON string starting at p (after the opening quote) */
+static bool
+bench_json_string (const char *p, GString *out)
+{
+	gunichar c, low;
+	char utf8[6];
+
+	while (*p && *p != '"') {
+		if (*p != '\\') {
+			g_string_append_c(out, *p++);
+			continue;
+		}
+		p++;
+		switch (*p) {
+			case 'n': g_string_append_c(out, '\n'); break;
+			case 'r': g_string_append_c(out, '\r'); break;
+			case 't': g_string_append_c(out, '\t'); break;
+			case 'b': g_string_append_c(out, '\b'); break;
+			case 'f': g_string_append_c(out, '\f'); break;
+			case 'u':
+				if (!g_ascii_isxdigit(p[1]) || !g_ascii_isxdigit(p[2]) || !g_ascii_isxdigit(p[3]) || !g_ascii_isxdigit(p[4]))
+					return false;
+				c = (g_ascii_xdigit_value(p[1]) << 12) | (g_ascii_xdigit_value(p[2]) << 8) |
+				    (g_ascii_xdigit_value(p[3]) << 4) | g_ascii_xdigit_value(p[4]);
+				p += 4;
+				/* Surrogate pair */
+				if (c >= 0xd800 && c < 0xdc00 && p[1] == '\\' && p[2] == 'u' && g_ascii_isxdigit(p[3]) &&
+				    g_ascii_isxdigit(p[4]) && g_ascii_isxdigit(p[5]) && g_ascii_isxdigit(p[6])) {
+					low = (g_ascii_xdigit_value(p[3]) << 12) | (g_ascii_xdigit_value(p[4]) << 8) |
+					      (g_ascii_xdigit_value(p[5]) << 4) | g_ascii_xdigit_value(p[6]);
+					if (low >= 0xdc00 && low < 0xe000) {
+						c = 0x10000 + ((c - 0xd800) << 10) + (low - 0xdc00);
+						p += 6;
+					}
+				}
+				g_string_append_len(out, utf8, g_unichar_to_utf8(c, utf8));
+				break;
+			case '\0':
+				return false;
+			default:
+				g_string_append_c(out, *p);
+		}
+		p++;
+	}
+
+	return *p == '"';
+}
+
+
+/* Load a recording. Asciicast files are replayed without the timing, only the output events */
+static GBytes *
+bench_load_replay (const char *path)
+{
+	GFile *file;
+	GInputStream *stream, *converted;
+	GDataInputStream *data;
+	GError *error = NULL;
+	GString *out;
+	gchar *line, *p;
+	gsize len;
+	bool header = true;
+
+	if (!g_str_has_suffix(path, ".cast") && !g_str_has_suffix(path, ".cast.gz")) {
+		gchar *contents;
+
+		if (!g_file_get_contents(path, &contents, &len, &error)) {
+			fprintf(stderr, "%s\n", error->message);
+			g_error_free(error);
+			return NULL;
+		}
+		return g_bytes_new_take(contents, len);
+	}
+
+	file = g_file_new_for_path(path);
+	stream = G_INPUT_STREAM(g_file_read(file, NULL, &error));
+	g_object_unref(file);
+	if (!stream) {
+		fprintf(stderr, "%s\n", error->message);
+		g_error_free(error);
+		return NULL;
+	}
+
+	if (g_str_has_suffix(path, ".gz")) {
+		GZlibDecompressor *decompressor = g_zlib_decompressor_new(G_ZLIB_COMPRESSOR_FORMAT_GZIP);
+		converted = g_converter_input_stream_new(stream, G_CONVERTER(decompressor));
+		g_object_unref(decompressor);
+		g_object_unref(stream);
+		stream = converted;
+	}
+
+	data = g_data_input_stream_new(stream);
+	g_object_unref(stream);
+
+	out = g_string_new(NULL);
+	while ((line = g_data_input_stream_read_line(data, &len, NULL, &error))) {
+		/* The first line is the header, the events are [time, "o", "data"] */
+		if (header) {
+			header = false;
+		} else if (line[0] == '[' && (p = strchr(line, ',')) && g_str_has_prefix(g_strchug(p + 1), "\"o\"")) {
+			p = strchr(g_strchug(p + 1) + 3, '"');
+			if (!p || !bench_json_string(p + 1, out)) {
+				fprintf(stderr, "%s: bad event, ignored\n", path);
+			}
+		}
+		g_free(line);
+	}
+	g_object_unref(data);
+
+	if (error) {
+		fprintf(stderr, "%s: %s\n", path, error->message);
+		g_error_free(error);
+		g_string_free(out, TRUE);
+		return NULL;
+	}
+
+	return g_string_free_to_bytes(out);
+}
+
+
+static void
+bench_add_run (const char *name, GBytes *data)
+{
+	struct bench_run *run;
+
+	run = g_new0(struct bench_run, 1);
+	run->name = g_strdup(name);
+	run->data = data;
+	run->frames = g_array_new(FALSE, FALSE, sizeof(gint64));
+	g_ptr_array_add(bench.runs, run);
+}
+
+
+static gint
+bench_compare_frames (gconstpointer a, gconstpointer b)
+{
+	gint64 x = *(const gint64 *) a, y = *(const gint64 *) b;
+
+	return x < y ? -1 : x > y;
+}
+
+
+/* Frame time percentile, in milliseconds */
+static double
+bench_percentile (GArray *frames, double percentile)
+{
+	guint index;
+
+	if (frames->len == 0)
+		return 0;
+
+	index = (guint) ceil(percentile * frames->len);
+	return g_array_index(frames, gint64, index > 0 ? index - 1 : 0) / 1000.0;
+}
+
+
+/* Doubles are written with the C locale, whatever the user's one is */
+static void
+bench_print_double (const char *key, double value, const char *separator)
+{
+	char buffer[G_ASCII_DTOSTR_BUF_SIZE];
+
+	printf("\"%s\": %s%s", key, g_ascii_formatd(buffer, sizeof(buffer), "%.3f", value), separator);
+}
+
+
+static void
+bench_print_versions (void)
+{
+	printf("{\n\t\"vte\": \"%u.%u.%u\",\n\t\"gtk\": \"%u.%u.%u\",\n\t\"backend\": \"%s\",\n",
+	       vte_get_major_version(), vte_get_minor_version(), vte_get_micro_version(),
+	       gtk_get_major_version(), gtk_get_minor_version(), gtk_get_micro_version(),
+	       G_OBJECT_TYPE_NAME(gdk_display_get_default()));
+}
+
+
+static void
+bench_report (void)
+{
+	struct bench_run *run;
+	GString *name;
+	GByteArray *carry;
+	double seconds;
+	guint i;
+
+	bench_print_versions();
+	printf("\t\"columns\": %ld,\n\t\"rows\": %ld,\n\t\"runs\": [\n",
+	       vte_terminal_get_column_count(VTE_TERMINAL(bench.sk_tab->vte)),
+	       vte_terminal_get_row_count(VTE_TERMINAL(bench.sk_tab->vte)));
+
+	name = g_string_new(NULL);
+	carry = g_byte_array_new();
+	for (i = 0; i < bench.runs->len; i++) {
+		run = g_ptr_array_index(bench.runs, i);
+		seconds = (run->end - run->start) / (double) G_USEC_PER_SEC;
+		g_array_sort(run->frames, bench_compare_frames);
+
+		g_string_truncate(name, 0);
+		g_byte_array_set_size(carry, 0);
+		sakura_recorder_escape(name, carry, (const guint8 *) run->name, strlen(run->name));
+
+		printf("\t\t{ \"stream\": \"%s\", \"bytes\": %" G_GSIZE_FORMAT ", ", name->str, g_bytes_get_size(run->data));
+		bench_print_double("seconds", seconds, ", ");
+		bench_print_double("mb_per_s", seconds > 0 ? g_bytes_get_size(run->data) / seconds / (1024*1024) : 0, ", ");
+		printf("\"frames\": %u, ", run->frames->len);
+		bench_print_double("frame_p50_ms", bench_percentile(run->frames, 0.50), ", ");
+		bench_print_double("frame_p99_ms", bench_percentile(run->frames, 0.99), " }");
+		printf("%s\n", i + 1 < bench.runs->len ? "," : "");
+	}
+	printf("\t]\n}\n");
+	fflush(stdout);
+
+	g_string_free(name, TRUE);
+	g_byte_array_free(carry, TRUE);
+}
+
+
+static void bench_start_run (void);
+static gboolean bench_memory_next (gpointer);
+
+/* Feed a chunk each time vte has processed the previous one, like a pty read */
+static gboolean
+bench_feed_cb (gpointer data)
+{
+	struct bench_run *run = g_ptr_array_index(bench.runs, bench.current);
+	gsize size = g_bytes_get_size(run->data), len;
+	const char *buffer = g_bytes_get_data(run->data, NULL);
+	gchar *end;
+
+	bench.idle_id = 0;
+
+	if (run->offset >= size)
+		return G_SOURCE_REMOVE;
+
+	len = MIN(BENCH_CHUNK_SIZE, size - run->offset);
+	vte_terminal_feed(VTE_TERMINAL(bench.sk_tab->vte), buffer + run->offset, len);
+	run->offset += len;
+	bench.feeding = true;
+
+	/* vte emits the title change after processing everything before it */
+	if (run->offset >= size) {
+		end = g_strdup_printf("\033]2;%s\007", bench.marker);
+		vte_terminal_feed(VTE_TERMINAL(bench.sk_tab->vte), end, strlen(end));
+		g_free(end);
+	}
+
+	return G_SOURCE_REMOVE;
+}
+
+
+static void
+bench_contents_changed_cb (VteTerminal *vte, gpointer data)
+{
+	if (bench.feeding && !bench.idle_id) {
+		bench.feeding = false;
+		bench.idle_id = g_idle_add(bench_feed_cb, NULL);
+	}
+}
+
+
+static void
+bench_title_changed_cb (VteTerminal *vte, gpointer data)
+{
+	struct bench_run *run;
+
+	if (!bench.marker || g_strcmp0(vte_terminal_get_window_title(vte), bench.marker) != 0)
+		return;
+
+	g_clear_pointer(&bench.marker, g_free);
+
+	/* In memory mode the tab is full, go on with the next one */
+	if (option_memory) {
+		bench.ntabs++;
+		g_idle_add(bench_memory_next, NULL);
+		return;
+	}
+
+	run = g_ptr_array_index(bench.runs, bench.current);
+	run->end = g_get_monotonic_time();
+
+	bench.current++;
+	bench_start_run();
+}
+
+
+static void
+bench_after_paint_cb (GdkFrameClock *clock, gpointer data)
+{
+	struct bench_run *run;
+	gint64 now, frame;
+
+	if (!bench.marker)
+		return;
+
+	run = g_ptr_array_index(bench.runs, bench.current);
+	now = g_get_monotonic_time();
+	frame = now - run->last_paint;
+	g_array_append_val(run->frames, frame);
+	run->last_paint = now;
+}
+
+
+static void
+bench_start_run (void)
+{
+	struct bench_run *run;
+
+	if (bench.current >= bench.runs->len) {
+		bench_report();
+		gtk_main_quit();
+		return;
+	}
+
+	/* Every run starts with an empty scrollback */
+	vte_terminal_reset(VTE_TERMINAL(bench.sk_tab->vte), TRUE, TRUE);
+
+	run = g_ptr_array_index(bench.runs, bench.current);
+	bench.marker = g_strdup_printf(BENCH_END_MARKER, bench.current);
+	run->start = run->last_paint = g_get_monotonic_time();
+	bench.feeding = false;
+	if (!bench.idle_id)
+		bench.idle_id = g_idle_add(bench_feed_cb, NULL);
+}
+
+
+static void
+bench_memory_report (void)
+{
+	struct bench_memory *step;
+	guint i;
+
+	bench_print_versions();
+	printf("\t\"fill_lines\": %d,\n\t\"scroll_lines\": %d,\n", option_fill, (int) sakura.scroll_lines);
+	printf("\t\"baseline_rss_kb\": %" G_GSIZE_FORMAT ",\n\t\"baseline_pss_kb\": %" G_GSIZE_FORMAT ",\n\t\"steps\": [\n",
+	       bench.base_rss, bench.base_pss);
+
+	for (i = 0; i < bench.memory->len; i++) {
+		step = &g_array_index(bench.memory, struct bench_memory, i);
+		printf("\t\t{ \"tabs\": %u, \"rss_kb\": %" G_GSIZE_FORMAT ", \"pss_kb\": %" G_GSIZE_FORMAT ", ",
+		       step->tabs, step->rss, step->pss);
+		bench_print_double("rss_per_tab_kb", ((double) step->rss - bench.base_rss) / step->tabs, ", ");
+		bench_print_double("pss_per_tab_kb", ((double) step->pss - bench.base_pss) / step->tabs, ", ");
+		printf("\"estimate_kb\": %" G_GSIZE_FORMAT " }%s\n", step->estimate, i + 1 < bench.memory->len ? "," : "");
+	}
+	printf("\t]\n}\n");
+	fflush(stdout);
+}
+
+
+/* Memory mode. Open tabs, each one with its scrollback filled, until the next count is reached */
+static gboolean
+bench_memory_next (gpointer data)
+{
+	struct bench_memory step;
+	struct sakura_tab *sk_tab;
+	guint target;
+	gint page;
+	gchar *end;
+
+	target = (guint) g_ascii_strtoull(bench.targets[bench.target], NULL, 10);
+
+	if (bench.ntabs < target) {
+		sk_tab = sakura_new_tab(false);
+		vte_terminal_set_input_enabled(VTE_TERMINAL(sk_tab->vte), FALSE);
+		g_signal_connect(sk_tab->vte, "window-title-changed", G_CALLBACK(bench_title_changed_cb), NULL);
+
+		bench.marker = g_strdup_printf(BENCH_END_MARKER, bench.ntabs);
+		end = g_strdup_printf("\033]2;%s\007", bench.marker);
+		vte_terminal_feed(VTE_TERMINAL(sk_tab->vte), g_bytes_get_data(bench.fill, NULL), g_bytes_get_size(bench.fill));
+		vte_terminal_feed(VTE_TERMINAL(sk_tab->vte), end, strlen(end));
+		g_free(end);
+		return G_SOURCE_REMOVE;
+	}
+
+	step.tabs = bench.ntabs;
+	sakura_process_memory(&step.rss, &step.pss);
+	step.estimate = 0;
+	for (page = 0; page < gtk_notebook_get_n_pages(GTK_NOTEBOOK(sakura.notebook)); page++) {
+		sk_tab = sakura_get_sktab(sakura, page);
+		step.estimate += sakura_tab_memory(sk_tab, NULL) / 1024;
+	}
+	g_array_append_val(bench.memory, step);
+
+	if (!bench.targets[++bench.target]) {
+		bench_memory_report();
+		gtk_main_quit();
+		return G_SOURCE_REMOVE;
+	}
+
+	return G_SOURCE_CONTINUE;
+}
+
+
+/* Start when the window is on the screen, so vte really draws */
+static gboolean
+bench_map_cb (GtkWidget *widget, GdkEvent *event, gpointer data)
+{
+	if (!bench.started) {
+		bench.started = true;
+		g_signal_connect(gtk_widget_get_frame_clock(sakura.main_window), "after-paint", G_CALLBACK(bench_after_paint_cb), NULL);
+		bench_start_run();
+	}
+
+	return FALSE;
+}
+
+
+int
+main(int argc, char **argv)
+{
+	GError *error = NULL;
+	GOptionContext *context;
+	GBytes *data;
+	GString *out;
+	guint i, j;
+
+	setlocale(LC_ALL, "");
+
+	context = g_option_context_new("- sakura output throughput benchmark");
+	g_option_context_add_main_entries(context, bench_entries, NULL);
+	g_option_context_add_group(context, gtk_get_option_group(FALSE));
+	if (!g_option_context_parse(context, &argc, &argv, &error)) {
+		fprintf(stderr, "%s\n", error->message);
+		g_error_free(error);
+		exit(1);
+	}
+	g_option_context_free(context);
+
+	bench.runs = g_ptr_array_new();
+
+	/* All the synthetic streams, unless some streams or recordings are given */
+	for (i = 0; i < G_N_ELEMENTS(bench_streams) && !option_memory; i++) {
+		if (option_streams ? !g_strv_contains((const gchar * const *) option_streams, bench_streams[i].name) : option_replays != NULL)
+			continue;
+		out = g_string_sized_new((gsize) option_size * 1024 * 1024 + BENCH_CHUNK_SIZE);
+		bench_streams[i].generate(out, (gsize) option_size * 1024 * 1024);
+		bench_add_run(bench_streams[i].name, g_string_free_to_bytes(out));
+	}
+
+	for (j = 0; option_streams && option_streams[j]; j++) {
+		for (i = 0; i < G_N_ELEMENTS(bench_streams); i++)
+			if (strcmp(option_streams[j], bench_streams[i].name) == 0)
+				break;
+		if (i == G_N_ELEMENTS(bench_streams)) {
+			fprintf(stderr, "Unknown stream %s\n", option_streams[j]);
+			exit(1);
+		}
+	}
+
+	for (j = 0; option_replays && option_replays[j]; j++) {
+		if (!(data = bench_load_replay(option_replays[j])))
+			exit(1);
+		bench_add_run(option_replays[j], data);
+	}
+
+	/* Same initialization than sakura */
+	sakura_load_config();
+	if (sakura.throughput)
+		g_setenv("NO_AT_BRIDGE", "1", TRUE);
+	gtk_init(&argc, &argv);
+	sakura_init();
+
+	if (option_memory) {
+		out = g_string_new(NULL);
+		for (i = 0; i < (guint) option_fill; i++)
+			g_string_append_printf(out, "%6u %s\r\n", i, "The quick brown fox jumps over the lazy dog, again and again and again");
+		bench.fill = g_string_free_to_bytes(out);
+		bench.targets = g_strsplit(option_tabs ? option_tabs : BENCH_DEFAULT_TABS, ",", -1);
+		bench.memory = g_array_new(FALSE, FALSE, sizeof(struct bench_memory));
+		if (!bench.targets[0]) {
+			fprintf(stderr, "No tab counts given\n");
+			exit(1);
+		}
+
+		/* The first tab also takes the memory of the window */
+		sakura_process_memory(&bench.base_rss, &bench.base_pss);
+		g_idle_add(bench_memory_next, NULL);
+		gtk_main();
+		return 0;
+	}
+
+	bench.sk_tab = sakura_new_tab(false);
+	vte_terminal_set_input_enabled(VTE_TERMINAL(bench.sk_tab->vte), FALSE);
+	g_signal_connect(bench.sk_tab->vte, "contents-changed", G_CALLBACK(bench_contents_changed_cb), NULL);
+	g_signal_connect(bench.sk_tab->vte, "window-title-changed", G_CALLBACK(bench_title_changed_cb), NULL);
+	g_signal_connect(sakura.main_window, "map-event", G_CALLBACK(bench_map_cb), NULL);
+
+	sakura.first_run = false;
+
+	gtk_main();
+
+	sakura_recorders_wait();
+
+	return 0;
+}
@@ -0,0 +1,393 @@
+/*******************************************************************************
+ *  Filename: sakura-latency.c
+ *  Description: Keystroke to screen latency benchmark for sakura
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ *****************************************************************************/
+
+/* Launches sakura running cat, types into it with XTest and waits for the window
+ * damage caused by the echoed character. Each scenario uses its own configuration
+ * file, without cursor blinking, so the only damage after a keystroke is the echo.
+ * The other tabs are opened with the new tab keybinding: with -n all the initial tabs
+ * would run the -x command. Run it under Xvfb, without a window manager:
+ * xvfb-run ./src/sakura-latency */
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <X11/Xlib.h>
+#include <X11/Xatom.h>
+#include <X11/extensions/XTest.h>
+#include <X11/extensions/Xdamage.h>
+
+#define LATENCY_DEFAULT_SAMPLES 200
+#define LATENCY_TIMEOUT 1000            /* Milliseconds to wait for the echo */
+#define LATENCY_QUIET 50                /* Milliseconds without damage between keystrokes */
+#define LATENCY_SETTLE 500              /* Milliseconds without damage before starting */
+#define LATENCY_STARTUP 60000           /* Milliseconds to wait for the window and the setup */
+#define LATENCY_LINE 60                 /* Characters typed before a new line */
+
+struct latency_scenario {
+	const char *name;
+	const char *description;
+	int ntabs;                      /* The first one runs the command, the others the shell */
+	const char *command;
+	const char *shell;              /* Script run by the other tabs */
+	int scroll_lines;
+};
+
+static const struct latency_scenario scenarios[] = {
+	{ "idle", "Only one tab", 1, "cat", NULL, 4096 },
+	{ "flood", "A background tab writing as fast as it can", 2, "cat", "exec yes 'sakura latency flood'", 4096 },
+	{ "tabs", "100 tabs open", 100, "cat", "exec cat", 4096 },
+	{ "scrollback", "500000 lines in the scrollback", 1,
+	  "sh -c 'seq -f %078g 1 500000; exec cat'", NULL, 1000000 },
+};
+
+static struct {
+	Display *display;
+	Window window;
+	Damage damage;
+	int damage_event;
+	gchar *tmpdir;
+} latency;
+
+static const char *option_sakura = "./src/sakura";
+static gint option_samples = LATENCY_DEFAULT_SAMPLES;
+static gchar **option_scenarios;
+
+static GOptionEntry entries[] = {
+	{ "sakura", 0, 0, G_OPTION_ARG_FILENAME, &option_sakura, "sakura executable (default ./src/sakura)", "PATH" },
+	{ "samples", 0, 0, G_OPTION_ARG_INT, &option_samples, "Keystrokes for each scenario", "N" },
+	{ "scenario", 's', 0, G_OPTION_ARG_STRING_ARRAY, &option_scenarios, "Scenario: idle, flood, tabs or scrollback (default all)", "NAME" },
+	{ NULL }
+};
+
+
+/* Wait for the next damage in the sakura window. Returns false on timeout */
+static bool
+latency_wait_damage (int timeout)
+{
+	gint64 end = g_get_monotonic_time() + (gint64) timeout * 1000;
+	struct pollfd pfd = { ConnectionNumber(latency.display), POLLIN, 0 };
+	XEvent event;
+	gint64 left;
+
+	while (true) {
+		while (XPending(latency.display)) {
+			XNextEvent(latency.display, &event);
+			if (event.type == latency.damage_event + XDamageNotify) {
+				XDamageSubtract(latency.display, latency.damage, None, None);
+				return true;
+			}
+		}
+
+		left = end - g_get_monotonic_time();
+		if (left <= 0)
+			return false;
+		poll(&pfd, 1, (int) ((left + 999) / 1000));
+	}
+}
+
+
+/* Wait until the window hasn't been damaged for some time */
+static bool
+latency_wait_quiet (int quiet, int timeout)
+{
+	gint64 end = g_get_monotonic_time() + (gint64) timeout * 1000;
+
+	while (latency_wait_damage(quiet)) {
+		if (g_get_monotonic_time() > end)
+			return false;
+	}
+
+	return true;
+}
+
+
+static void
+latency_key (KeySym keysym, KeySym modifier)
+{
+	KeyCode mod = modifier ? XKeysymToKeycode(latency.display, modifier) : 0;
+	KeyCode key = XKeysymToKeycode(latency.display, keysym);
+
+	if (mod) XTestFakeKeyEvent(latency.display, mod, True, CurrentTime);
+	XTestFakeKeyEvent(latency.display, key, True, CurrentTime);
+	XTestFakeKeyEvent(latency.display, key, False, CurrentTime);
+	if (mod) XTestFakeKeyEvent(latency.display, mod, False, CurrentTime);
+	XFlush(latency.display);
+}
+
+
+/* Open a tab running the shell, with the default keybinding (Ctrl+Shift+T) */
+static void
+latency_new_tab (void)
+{
+	KeyCode control = XKeysymToKeycode(latency.display, XK_Control_L);
+	KeyCode shift = XKeysymToKeycode(latency.display, XK_Shift_L);
+	KeyCode key = XKeysymToKeycode(latency.display, XK_T);
+
+	XTestFakeKeyEvent(latency.display, control, True, CurrentTime);
+	XTestFakeKeyEvent(latency.display, shift, True, CurrentTime);
+	XTestFakeKeyEvent(latency.display, key, True, CurrentTime);
+	XTestFakeKeyEvent(latency.display, key, False, CurrentTime);
+	XTestFakeKeyEvent(latency.display, shift, False, CurrentTime);
+	XTestFakeKeyEvent(latency.display, control, False, CurrentTime);
+	XFlush(latency.display);
+}
+
+
+/* GTK sets _NET_WM_PID in its toplevel windows */
+static Window
+latency_find_window (Window parent, Atom pid_atom, GPid pid)
+{
+	Window root, parent_return, *children, found = None;
+	XWindowAttributes attributes;
+	unsigned int nchildren, i;
+	Atom type; int format;
+	unsigned long nitems, after;
+	unsigned char *data;
+
+	if (!XQueryTree(latency.display, parent, &root, &parent_return, &children, &nchildren))
+		return None;
+
+	for (i = 0; i < nchildren && found == None; i++) {
+		if (XGetWindowProperty(latency.display, children[i], pid_atom, 0, 1, False, XA_CARDINAL,
+		                       &type, &format, &nitems, &after, &data) == Success && data) {
+			if (nitems == 1 && *(unsigned long *) data == (unsigned long) pid &&
+			    XGetWindowAttributes(latency.display, children[i], &attributes) &&
+			    attributes.map_state == IsViewable) {
+				found = children[i];
+			}
+			XFree(data);
+		}
+		if (found == None)
+			found = latency_find_window(children[i], pid_atom, pid);
+	}
+
+	if (children)
+		XFree(children);
+
+	return found;
+}
+
+
+static gint
+latency_compare (gconstpointer a, gconstpointer b)
+{
+	gint64 x = *(const gint64 *) a, y = *(const gint64 *) b;
+
+	return x < y ? -1 : x > y;
+}
+
+
+static double
+latency_percentile (GArray *samples, double percentile)
+{
+	guint index;
+
+	if (samples->len == 0)
+		return 0;
+
+	index = (guint) (percentile * samples->len + 0.999999);
+	return g_array_index(samples, gint64, index > 0 ? index - 1 : 0) / 1000.0;
+}
+
+
+static void
+latency_print_double (const char *key, double value, const char *separator)
+{
+	char buffer[G_ASCII_DTOSTR_BUF_SIZE];
+
+	printf("\"%s\": %s%s", key, g_ascii_formatd(buffer, sizeof(buffer), "%.3f", value), separator);
+}
+
+
+/* Run sakura with the scenario setup and measure the keystrokes. Returns false if sakura
+ * couldn't be started */
+static bool
+latency_run (const struct latency_scenario *scenario, bool first)
+{
+	GError *error = NULL;
+	gchar *config, *shell, *contents;
+	gchar **envp;
+	GPid pid;
+	Atom pid_atom;
+	GArray *samples;
+	gint64 start, latency_us;
+	guint timeouts = 0;
+	gint64 end;
+	int i;
+
+	/* Each scenario has its own configuration, and the other tabs run a script as shell */
+	config = g_build_filename(latency.tmpdir, "sakura.conf", NULL);
+	contents = g_strdup_printf("[sakura]\nblinking_cursor=No\nscroll_lines=%d\n", scenario->scroll_lines);
+	g_file_set_contents(config, contents, -1, NULL);
+	g_free(contents);
+
+	shell = g_build_filename(latency.tmpdir, "shell", NULL);
+	contents = g_strdup_printf("#!/bin/sh\n%s\n", scenario->shell ? scenario->shell : "exec cat");
+	g_file_set_contents(shell, contents, -1, NULL);
+	g_chmod(shell, 0755);
+	g_free(contents);
+
+	envp = g_environ_setenv(g_get_environ(), "SHELL", shell, TRUE);
+
+	const gchar *argv[] = { option_sakura, "--config-file", config, "-x", scenario->command, NULL };
+	if (!g_spawn_async(NULL, (gchar **) argv, envp, G_SPAWN_DO_NOT_REAP_CHILD, NULL, NULL, &pid, &error)) {
+		fprintf(stderr, "Cannot run %s: %s\n", option_sakura, error->message);
+		g_error_free(error);
+		return false;
+	}
+	g_strfreev(envp);
+
+	pid_atom = XInternAtom(latency.display, "_NET_WM_PID", False);
+	end = g_get_monotonic_time() + (gint64) LATENCY_STARTUP * 1000;
+	while ((latency.window = latency_find_window(DefaultRootWindow(latency.display), pid_atom, pid)) == None) {
+		if (g_get_monotonic_time() > end) {
+			fprintf(stderr, "The sakura window didn't show up\n");
+			kill(pid, SIGTERM);
+			waitpid(pid, NULL, 0);
+			return false;
+		}
+		g_usleep(100000);
+	}
+
+	latency.damage = XDamageCreate(latency.display, latency.window, XDamageReportNonEmpty);
+	XSetInputFocus(latency.display, latency.window, RevertToParent, CurrentTime);
+	XSync(latency.display, False);
+
+	/* The new tabs are added after the one running the command, go back to it */
+	for (i = 1; i < scenario->ntabs; i++)
+		latency_new_tab();
+	if (scenario->ntabs > 1)
+		latency_key(XK_1, XK_Alt_L);
+
+	if (!latency_wait_quiet(LATENCY_SETTLE, LATENCY_STARTUP))
+		fprintf(stderr, "%s: the window is still changing, measuring anyway\n", scenario->name);
+
+	samples = g_array_new(FALSE, FALSE, sizeof(gint64));
+	for (i = 0; i < option_samples; i++) {
+		start = g_get_monotonic_time();
+		latency_key(XK_a + i % 26, 0);
+		if (latency_wait_damage(LATENCY_TIMEOUT)) {
+			latency_us = g_get_monotonic_time() - start;
+			g_array_append_val(samples, latency_us);
+		} else {
+			timeouts++;
+		}
+		latency_wait_quiet(LATENCY_QUIET, LATENCY_TIMEOUT);
+
+		/* Start a new line from time to time, it's not measured */
+		if ((i + 1) % LATENCY_LINE == 0) {
+			latency_key(XK_Return, 0);
+			latency_wait_quiet(LATENCY_QUIET, LATENCY_TIMEOUT);
+		}
+	}
+
+	XDamageDestroy(latency.display, latency.damage);
+	XSync(latency.display, False);
+	kill(pid, SIGTERM);
+	waitpid(pid, NULL, 0);
+	g_spawn_close_pid(pid);
+	g_unlink(config);
+	g_unlink(shell);
+	g_free(config);
+	g_free(shell);
+
+	g_array_sort(samples, latency_compare);
+	printf("%s\t\t{ \"scenario\": \"%s\", \"description\": \"%s\", \"samples\": %u, \"timeouts\": %u, ",
+	       first ? "" : ",\n", scenario->name, scenario->description, samples->len, timeouts);
+	latency_print_double("p50_ms", latency_percentile(samples, 0.50), ", ");
+	latency_print_double("p90_ms", latency_percentile(samples, 0.90), ", ");
+	latency_print_double("p99_ms", latency_percentile(samples, 0.99), ", ");
+	latency_print_double("max_ms", latency_percentile(samples, 1.0), " }");
+	fflush(stdout);
+
+	g_array_free(samples, TRUE);
+
+	return true;
+}
+
+
+int
+main(int argc, char **argv)
+{
+	GError *error = NULL;
+	GOptionContext *context;
+	int event_base, error_base, major, minor;
+	guint i, n;
+	bool ok = true, first = true;
+
+	context = g_option_context_new("- sakura keystroke latency benchmark");
+	g_option_context_add_main_entries(context, entries, NULL);
+	if (!g_option_context_parse(context, &argc, &argv, &error)) {
+		fprintf(stderr, "%s\n", error->message);
+		g_error_free(error);
+		exit(1);
+	}
+	g_option_context_free(context);
+
+	for (i = 0; option_scenarios && option_scenarios[i]; i++) {
+		for (n = 0; n < G_N_ELEMENTS(scenarios); n++)
+			if (strcmp(option_scenarios[i], scenarios[n].name) == 0)
+				break;
+		if (n == G_N_ELEMENTS(scenarios)) {
+			fprintf(stderr, "Unknown scenario %s\n", option_scenarios[i]);
+			exit(1);
+		}
+	}
+
+	if (!(latency.display = XOpenDisplay(NULL))) {
+		fprintf(stderr, "Cannot open the display\n");
+		exit(1);
+	}
+
+	if (!XTestQueryExtension(latency.display, &event_base, &error_base, &major, &minor) ||
+	    !XDamageQueryExtension(latency.display, &latency.damage_event, &error_base)) {
+		fprintf(stderr, "The X server doesn't have the XTEST and DAMAGE extensions\n");
+		exit(1);
+	}
+
+	if (!(latency.tmpdir = g_dir_make_tmp("sakura-latency-XXXXXX", &error))) {
+		fprintf(stderr, "%s\n", error->message);
+		g_error_free(error);
+		exit(1);
+	}
+
+	/* The separators are written before each scenario, so a failed one leaves valid JSON */
+	printf("{\n\t\"scenarios\": [\n");
+	for (n = 0; n < G_N_ELEMENTS(scenarios) && ok; n++) {
+		if (option_scenarios && !g_strv_contains((const gchar * const *) option_scenarios, scenarios[n].name))
+			continue;
+		if ((ok = latency_run(&scenarios[n], first)))
+			first = false;
+	}
+	printf("%s\t]\n}\n", first ? "" : "\n");
+
+	g_rmdir(latency.tmpdir);
+	g_free(latency.tmpdir);
+	XCloseDisplay(latency.display);
+
+	return ok ? 0 : 1;
+}
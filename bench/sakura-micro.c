@@ -0,0 +1,194 @@
+/*******************************************************************************
+ *  Filename: sakura-micro.c
+ *  Description: Micro-benchmarks for the libsakura helpers
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ *****************************************************************************/
+
+/* Each helper is called in a loop, doubling the iterations until the loop takes at
+ * least MICRO_MIN_TIME. No display is needed, the keycode mapping is only measured
+ * when there is one. The results, in nanoseconds per call, are written as JSON */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <gdk/gdk.h>
+#include "../src/libsakura.h"
+
+#define MICRO_MIN_TIME (200*1000)       /* Microseconds */
+
+static struct {
+	GKeyFile *cfg;
+	gchar *config_path;
+	gchar *osc7_uri;
+	GdkKeymap *keymap;
+} micro;
+
+static gchar *xterm_args[] = { "vim", "-c", "set ft=c", "some file.c", NULL };
+
+
+static void
+micro_config_load (void)
+{
+	GKeyFile *cfg = g_key_file_new();
+
+	sakura_config_load(cfg, micro.config_path, NULL);
+	g_key_file_free(cfg);
+}
+
+
+static void
+micro_keybind (void)
+{
+	sakura_config_get_keybind(micro.cfg, "sakura", "copy_key");
+	sakura_config_get_keybind(micro.cfg, "sakura", "legacy_key");
+}
+
+
+static void
+micro_keycode (void)
+{
+	guint key;
+
+	for (key = GDK_KEY_a; key <= GDK_KEY_z; key++)
+		sakura_keyval_to_keycode(micro.keymap, key);
+}
+
+
+static void
+micro_command_execute (void)
+{
+	int argc; char **argv;
+
+	if (sakura_command_parse("vim -c 'set ft=c' \"some file.c\"", NULL, &argc, &argv, NULL))
+		g_strfreev(argv);
+}
+
+
+static void
+micro_command_xterm (void)
+{
+	int argc; char **argv;
+
+	if (sakura_command_parse(NULL, xterm_args, &argc, &argv, NULL))
+		g_strfreev(argv);
+}
+
+
+static void
+micro_pid_cwd (void)
+{
+	g_free(sakura_pid_cwd(getpid()));
+}
+
+
+static void
+micro_osc7_cwd (void)
+{
+	g_free(sakura_osc7_cwd(micro.osc7_uri));
+}
+
+
+static void
+micro_tab_title (void)
+{
+	g_free(sakura_tab_title("user@host: ~/src/sakura/a/rather/long/directory/name", 1));
+	g_free(sakura_tab_title("vim", 2));
+	g_free(sakura_tab_title(NULL, 3));
+}
+
+
+static const struct {
+	const char *name;
+	void (*run)(void);
+	bool needs_display;
+} benchmarks[] = {
+	{ "config_load", micro_config_load, false },
+	{ "keybind", micro_keybind, false },
+	{ "keycode", micro_keycode, true },
+	{ "command_execute", micro_command_execute, false },
+	{ "command_xterm", micro_command_xterm, false },
+	{ "pid_cwd", micro_pid_cwd, false },
+	{ "osc7_cwd", micro_osc7_cwd, false },
+	{ "tab_title", micro_tab_title, false },
+};
+
+
+/* A configuration file like the one sakura writes */
+static void
+micro_setup (void)
+{
+	GString *contents;
+	int i;
+
+	contents = g_string_new("[sakura]\ncopy_key=C\nlegacy_key=86\nfont=Ubuntu Mono,monospace 13\n");
+	for (i = 0; i < 100; i++) {
+		g_string_append_printf(contents, "option_%d=value %d\n", i, i);
+	}
+
+	micro.cfg = g_key_file_new();
+	g_key_file_load_from_data(micro.cfg, contents->str, contents->len, 0, NULL);
+
+	g_file_open_tmp("sakura-micro-XXXXXX.conf", &micro.config_path, NULL);
+	g_file_set_contents(micro.config_path, contents->str, contents->len, NULL);
+	g_string_free(contents, TRUE);
+
+	micro.osc7_uri = g_strdup_printf("file://%s/home/user/some%%20directory", g_get_host_name());
+
+	if (gdk_init_check(NULL, NULL))
+		micro.keymap = gdk_keymap_get_for_display(gdk_display_get_default());
+}
+
+
+int
+main(int argc, char **argv)
+{
+	char buffer[G_ASCII_DTOSTR_BUF_SIZE];
+	gint64 start, elapsed;
+	guint64 iterations, i;
+	guint n;
+	bool first = true;
+
+	micro_setup();
+
+	printf("{\n");
+	for (n = 0; n < G_N_ELEMENTS(benchmarks); n++) {
+		if (argc > 1 && !g_strv_contains((const gchar * const *) argv + 1, benchmarks[n].name))
+			continue;
+		if (benchmarks[n].needs_display && !micro.keymap)
+			continue;
+
+		iterations = 1;
+		do {
+			iterations *= 2;
+			start = g_get_monotonic_time();
+			for (i = 0; i < iterations; i++)
+				benchmarks[n].run();
+			elapsed = g_get_monotonic_time() - start;
+		} while (elapsed < MICRO_MIN_TIME);
+
+		printf("%s\t\"%s_ns\": %s", first ? "" : ",\n", benchmarks[n].name,
+		       g_ascii_formatd(buffer, sizeof(buffer), "%.1f", elapsed * 1000.0 / iterations));
+		first = false;
+	}
+	printf("\n}\n");
+
+	g_unlink(micro.config_path);
+
+	return 0;
+}
@@ -0,0 +1,75 @@
+#!/bin/sh
+#
+# Cold start benchmark. Runs sakura --startup-trace several times, waits for the
+# first output of the shell and prints the distribution of every startup phase
+# as JSON. It needs a display, Xvfb is fine:
+#
+#	xvfb-run bench/startup.sh -n 50 -s ./src/sakura
+#
+# Arguments after -- are passed to sakura.
+
+runs=20
+sakura=./src/sakura
+timeout=10
+
+usage() {
+	echo "Usage: $0 [-n RUNS] [-s SAKURA] [-t TIMEOUT] [-- SAKURA ARGUMENTS]" >&2
+	exit 1
+}
+
+while getopts "n:s:t:h" opt; do
+	case $opt in
+		n) runs=$OPTARG ;;
+		s) sakura=$OPTARG ;;
+		t) timeout=$OPTARG ;;
+		*) usage ;;
+	esac
+done
+shift $((OPTIND - 1))
+
+tmpdir=$(mktemp -d) || exit 1
+trap 'rm -rf "$tmpdir"' EXIT
+
+i=0
+while [ $i -lt "$runs" ]; do
+	log="$tmpdir/run$i"
+	"$sakura" --startup-trace "$@" 2>"$log" &
+	pid=$!
+
+	# The output phase is the last one, the shell is ready
+	waited=0
+	until grep -q "^startup: output" "$log"; do
+		if ! kill -0 $pid 2>/dev/null || [ $waited -ge $((timeout * 100)) ]; then
+			echo "Run $i didn't finish the startup" >&2
+			break
+		fi
+		sleep 0.01
+		waited=$((waited + 1))
+	done
+
+	kill $pid 2>/dev/null
+	wait $pid 2>/dev/null
+	grep "^startup: " "$log" >>"$tmpdir/phases"
+	i=$((i + 1))
+done
+
+[ -s "$tmpdir/phases" ] || { echo "No startup trace, is $sakura built with --startup-trace?" >&2; exit 1; }
+
+# One entry per phase, with its times sorted
+awk '{ print $2, $3 }' "$tmpdir/phases" | sort -s -k1,1 -k2,2g | awk -v runs="$runs" '
+	function percentile(p,   i) {
+		i = int(p * n + 0.999999)
+		return times[i > 0 ? i : 1]
+	}
+	function report() {
+		if (n == 0)
+			return
+		lines = lines sprintf("%s\t\t\"%s\": { \"runs\": %d, \"min_ms\": %s, \"p50_ms\": %s, \"p90_ms\": %s, \"max_ms\": %s }",
+		                      lines == "" ? "" : ",\n", phase, n, times[1], percentile(0.5), percentile(0.9), times[n])
+	}
+	$1 != phase { report(); phase = $1; n = 0 }
+	{ times[++n] = $2 }
+	END {
+		report()
+		printf("{\n\t\"runs\": %d,\n\t\"phases\": {\n%s\n\t}\n}\n", runs, lines)
+	}'
@@ -0,0 +1,232 @@
+/*******************************************************************************
+ *  Filename: libsakura.c
+ *  Description: sakura helpers without user interface
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ *****************************************************************************/
+
+/* Nothing here uses the sakura globals or needs a display (but for the keymap, which
+ * is given by the caller), so these functions can be benchmarked in isolation */
+
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <libintl.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+#include "libsakura.h"
+
+#define _(String) gettext(String)
+
+
+/* Path of the configuration file, creating the sakura config directory if needed */
+gchar *
+sakura_config_path (const char *config_file)
+{
+	gchar *configdir, *path;
+
+	configdir = g_build_filename(g_get_user_config_dir(), "sakura", NULL);
+	if (!g_file_test(g_get_user_config_dir(), G_FILE_TEST_EXISTS))
+		g_mkdir(g_get_user_config_dir(), 0755);
+	if (!g_file_test(configdir, G_FILE_TEST_EXISTS))
+		g_mkdir(configdir, 0755);
+
+	/* Don't force the config path for user conf file */
+	if (config_file) {
+		path = g_strdup(config_file);
+	} else {
+		path = g_build_filename(configdir, DEFAULT_CONFIGFILE, NULL);
+	}
+	g_free(configdir);
+
+	return path;
+}
+
+
+/* Load the configuration file. A missing or unreadable file is not an error, a new one is created */
+bool
+sakura_config_load (GKeyFile *cfg, const char *path, GError **error)
+{
+	GError *gerror = NULL;
+
+	if (!g_key_file_load_from_file(cfg, path, 0, &gerror)) {
+		if (gerror->code == G_KEY_FILE_ERROR_UNKNOWN_ENCODING || gerror->code == G_KEY_FILE_ERROR_INVALID_VALUE) {
+			g_propagate_error(error, gerror);
+			return false;
+		}
+		g_error_free(gerror);
+	}
+
+	return true;
+}
+
+
+/* Keybindings are stored by name, older configuration files used the keyval */
+guint
+sakura_config_get_keybind (GKeyFile *cfg, const char *group, const char *key)
+{
+	gchar *value;
+	guint retval = GDK_KEY_VoidSymbol;
+
+	value = g_key_file_get_string(cfg, group, key, NULL);
+	if (value != NULL) {
+		retval = gdk_keyval_from_name(value);
+		g_free(value);
+	}
+
+	/* For backwards compatibility with integer values */
+	/* If gdk_keyval_from_name fail, it seems to be integer value*/
+	if ((retval == GDK_KEY_VoidSymbol) || (retval == 0)) {
+		retval = g_key_file_get_integer(cfg, group, key, NULL);
+	}
+
+	/* Always use uppercase value as keyval */
+	return gdk_keyval_to_upper(retval);
+}
+
+
+/* Hardware keycode of a keyval, keybindings are compared by keycode to ignore the keyboard layout */
+guint
+sakura_keyval_to_keycode (GdkKeymap *keymap, guint key)
+{
+	GdkKeymapKey *keys;
+	gint n_keys;
+	guint res = 0;
+
+	/* Empty shortcut */
+	if (key == 0) return 0;
+
+	if (gdk_keymap_get_entries_for_keyval(keymap, key, &keys, &n_keys)) {
+		if (n_keys > 0) {
+			res = keys[0].keycode;
+		}
+		g_free(keys);
+	}
+
+	return res;
+}
+
+
+/* Build the argv of the command given with -x (a single argument) or -e (all the arguments
+ * after it). Returns true, without touching argc and argv, if there's no command */
+bool
+sakura_command_parse (const char *execute, char **xterm_args, int *argc, char ***argv, GError **error)
+{
+	gchar **quoted_args, *command_joined;
+	guint size, i;
+	bool ret;
+
+	/* -x option: only one argument */
+	if (execute)
+		return g_shell_parse_argv(execute, argc, argv, error);
+
+	if (!xterm_args)
+		return true;
+
+	/* -e option: quote all arguments to be able to use parameters with spaces like filenames */
+	size = g_strv_length(xterm_args);
+	quoted_args = g_new(gchar *, size + 1);
+	for (i = 0; i < size; i++) {
+		quoted_args[i] = g_shell_quote(xterm_args[i]);
+	}
+	quoted_args[size] = NULL;
+
+	/* Join all arguments and parse them to create argc&argv */
+	command_joined = g_strjoinv(" ", quoted_args);
+	ret = g_shell_parse_argv(command_joined, argc, argv, error);
+
+	g_free(command_joined);
+	g_strfreev(quoted_args);
+
+	return ret;
+}
+
+
+/* Legacy way to get the cwd of a tab, if our shell doesn't emit OSC7. Original borrowed
+ * from gnome-terminal. Adapted by Hong Jen Yee and David Gómez */
+gchar *
+sakura_pid_cwd (GPid pid)
+{
+	char *cwd = NULL;
+	char *file, *buf;
+	struct stat sb;
+	int len;
+
+	if (pid < 0)
+		return NULL;
+
+	file = g_strdup_printf("/proc/%d/cwd", pid);
+
+	if (g_stat(file, &sb) == -1) {
+		g_free(file);
+		return NULL;
+	}
+
+	buf = g_malloc(sb.st_size + 1);
+	len = readlink(file, buf, sb.st_size + 1);
+
+	if (len > 0 && buf[0] == '/') {
+		buf[len] = '\0';
+		cwd = g_strdup(buf);
+	}
+
+	g_free(buf);
+	g_free(file);
+
+	return cwd;
+}
+
+
+/* The cwd from the OSC7 file URI, only if it's from this host */
+gchar *
+sakura_osc7_cwd (const char *osc7_uri)
+{
+	gchar *cwd = NULL; gchar *osc7_hostname = NULL;
+	const char *hostname;
+
+	if (!osc7_uri)
+		return NULL;
+
+	cwd = g_filename_from_uri(osc7_uri, &osc7_hostname, NULL);
+
+	/* Check if the hostname matchs. If not, return NULL */
+	hostname = g_get_host_name();
+	if ((g_strcmp0(osc7_hostname, hostname) != 0) || (g_strcmp0(osc7_hostname, "localhost") == 0)) {
+		g_free(cwd);
+		cwd = NULL;
+	}
+	g_free(osc7_hostname);
+
+	return cwd;
+}
+
+
+/* Tab label text for a title: chopped to the maximum size and padded to the minimum one,
+ * or the default label if there's no title */
+gchar *
+sakura_tab_title (const char *title, gint page)
+{
+	gchar *chopped_title, *label;
+
+	if ((title == NULL) || (title[0] == '\0'))
+		return g_strdup_printf(_("Terminal %d"), page);
+
+	chopped_title = g_strndup(title, TAB_MAX_SIZE);
+	label = g_strdup_printf("%-*s", TAB_MIN_SIZE, chopped_title);
+	g_free(chopped_title);
+
+	return label;
+}
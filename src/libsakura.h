@@ -0,0 +1,49 @@
+/*******************************************************************************
+ *  Filename: libsakura.h
+ *  Description: sakura helpers without user interface
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ *****************************************************************************/
+
+#ifndef LIBSAKURA_H
+#define LIBSAKURA_H
+
+#include <stdbool.h>
+#include <glib.h>
+#include <gdk/gdk.h>
+
+#define DEFAULT_CONFIGFILE "sakura.conf"
+#define TAB_MAX_SIZE 40
+#define TAB_MIN_SIZE 6
+
+/* Configuration file */
+gchar *  sakura_config_path (const char *);
+bool     sakura_config_load (GKeyFile *, const char *, GError **);
+guint    sakura_config_get_keybind (GKeyFile *, const char *, const char *);
+
+/* Keybindings */
+guint    sakura_keyval_to_keycode (GdkKeymap *, guint);
+
+/* Command line commands */
+bool     sakura_command_parse (const char *, char **, int *, char ***, GError **);
+
+/* Working directories */
+gchar *  sakura_pid_cwd (GPid);
+gchar *  sakura_osc7_cwd (const char *);
+
+/* Tab titles */
+gchar *  sakura_tab_title (const char *, gint);
+
+#endif
@@ -26,37 +26,194 @@
 #include <string.h>
 #include <stdarg.h>
 #include <unistd.h>
+#include <errno.h>
 #include <wchar.h>
 #include <math.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <sys/stat.h>
+#include <termios.h>
 #include <fcntl.h>
+#include <signal.h>
+#include <pthread.h>
+#include <semaphore.h>
+#ifdef HAVE_EXECINFO_H
+#include <execinfo.h>
+#endif
 #include <locale.h>
 #include <libintl.h>
 #include <glib.h>
 #include <glib/gstdio.h>
+#include <glib-unix.h>
 #include <gio/gdesktopappinfo.h>
+#include <gio/gunixinputstream.h>
+#include <gio/gunixoutputstream.h>
+#include <gio/gunixsocketaddress.h>
 #include <gdk/gdk.h>
 #include <gdk/gdkx.h>
 #include <gtk/gtk.h>
 #include <pango/pango.h>
 #include <vte/vte.h>
+#include "libsakura.h"
 
 #define _(String) gettext(String)
 #define N_(String) (String)
 #define GETTEXT_PACKAGE "sakura"
 
-#define SAY(format,...) do {\
-	if (strcmp("Debug", BUILDTYPE)==0) {\
-	    fprintf(stderr, "[%d] ", getpid());\
-	    fprintf(stderr, "[%s] ", __FUNCTION__);\
-	    if (format) fprintf(stderr, format, ##__VA_ARGS__);\
-	    fputc('\n', stderr);\
-		fflush(stderr);\
+/* Trace ring. The last TRACE_RING_SIZE events (timestamp, event and two arguments) are
+ * always kept in memory, and written to $XDG_STATE_HOME/sakura/trace.log on SIGUSR1
+ * or when sakura crashes. Must be a power of two */
+#define TRACE_RING_SIZE 4096
+
+typedef enum {
+	TRACE_NONE,
+	TRACE_LOG,          /* Source line and level of a log call, even if it's not compiled */
+	TRACE_TAB_NEW,      /* Page, number of pages */
+	TRACE_TAB_CLOSE,    /* Page, number of pages */
+	TRACE_TAB_SWITCH,   /* Page */
+	TRACE_SPAWN,        /* Child pid, -1 if the spawn failed */
+	TRACE_CHILD_EXIT,   /* Page, child pid */
+	TRACE_RESIZE,       /* Columns, rows */
+	TRACE_SUSPEND,      /* Suspended */
+	TRACE_CONFIG_SAVE,
+	TRACE_STALL,        /* Milliseconds, whether the stall has ended */
+	TRACE_DUMP,         /* Signal, 0 if requested with SIGUSR1 */
+	TRACE_EVENTS
+} TraceEvent;
+
+static const char *trace_event_names[TRACE_EVENTS] = {
+	"none", "log", "tab_new", "tab_close", "tab_switch", "spawn", "child_exit",
+	"resize", "suspend", "config_save", "stall", "dump"
+};
+
+struct sakura_trace_entry {
+	gint64 time;        /* Microseconds since the start */
+	gint64 arg0, arg1;
+	TraceEvent event;
+};
+
+static struct {
+	struct sakura_trace_entry entries[TRACE_RING_SIZE];
+	gint next;          /* Entries written, wraps around */
+	gint64 start;
+	char *path;         /* Built beforehand, the crash handler can't allocate */
+	char *old_path;
+} trace_ring;
+
+
+/* Lock-free, the watchdog thread writes to the ring too */
+static inline void
+sakura_trace (TraceEvent event, gint64 arg0, gint64 arg1)
+{
+	struct sakura_trace_entry *entry;
+
+	entry = &trace_ring.entries[(guint) g_atomic_int_add(&trace_ring.next, 1) & (TRACE_RING_SIZE - 1)];
+	entry->time = g_get_monotonic_time() - trace_ring.start;
+	entry->event = event;
+	entry->arg0 = arg0;
+	entry->arg1 = arg1;
+}
+
+
+/* Log levels. Messages above SAKURA_LOG_LEVEL are not compiled in (set it with
+ * -DLOG_LEVEL=N, debug builds default to SAKURA_LOG_DEBUG) */
+/* Functions only called from main, which is compiled out in the benchmark (bench/sakura-bench.c) */
+#ifdef SAKURA_BENCH
+#define MAIN_ONLY G_GNUC_UNUSED
+#else
+#define MAIN_ONLY
+#endif
+
+#define SAKURA_LOG_NONE 0
+#define SAKURA_LOG_WARNING 1
+#define SAKURA_LOG_INFO 2
+#define SAKURA_LOG_DEBUG 3
+
+#ifndef SAKURA_LOG_LEVEL
+#define SAKURA_LOG_LEVEL SAKURA_LOG_WARNING
+#endif
+
+#define SAKURA_LOG(level, format, ...) do {\
+	sakura_trace(TRACE_LOG, __LINE__, SAKURA_LOG_##level);\
+	if (SAKURA_LOG_##level <= SAKURA_LOG_LEVEL) {\
+		fprintf(stderr, "[%d] [%s] " format "\n", getpid(), __func__, ##__VA_ARGS__);\
 	}\
 } while (0)
 
+#define WARN(format, ...) SAKURA_LOG(WARNING, format, ##__VA_ARGS__)
+#define INFO(format, ...) SAKURA_LOG(INFO, format, ##__VA_ARGS__)
+#define SAY(format, ...) SAKURA_LOG(DEBUG, format, ##__VA_ARGS__)
+
+/* Signal handlers connected with g_signal_connect* are run between closure guards, which keep
+ * the name of the running handler for the stall watchdog. They are only added when the watchdog
+ * is enabled, or in builds with callback statistics */
+#define CALLBACK_MAX_DEPTH 32     /* Handlers can be nested, by dialogs or signal emissions */
+
+struct sakura_callback {
+	gchar *name;
+#ifdef SAKURA_CALLBACK_STATS
+	struct sakura_stats *stats;
+#endif
+};
+
+static struct sakura_callback *sakura_callback_get (const char *);
+static gulong   sakura_connect (gpointer, const gchar *, GCallback, gpointer, const char *, GConnectFlags);
+
+#undef g_signal_connect
+#undef g_signal_connect_after
+#undef g_signal_connect_swapped
+#define g_signal_connect(instance, signal, callback, data) \
+	sakura_connect((instance), (signal), (callback), (data), #callback, 0)
+#define g_signal_connect_after(instance, signal, callback, data) \
+	sakura_connect((instance), (signal), (callback), (data), #callback, G_CONNECT_AFTER)
+#define g_signal_connect_swapped(instance, signal, callback, data) \
+	sakura_connect((instance), (signal), (callback), (data), #callback, G_CONNECT_SWAPPED)
+
+/* Callback latency statistics, only in builds with -DCALLBACK_STATS=ON. Every signal
+ * handler connected with g_signal_connect* is timed by the closure guards, and functions
+ * called outside handlers are timed with STATS_SCOPE. Without it everything compiles out */
+#ifdef SAKURA_CALLBACK_STATS
+#define STATS_SUB_BITS 3          /* 8 buckets per power of two, 12.5% precision */
+#define STATS_BUCKETS ((64 - STATS_SUB_BITS + 1) << STATS_SUB_BITS)
+
+/* Log-linear (HDR style) histogram of durations in microseconds */
+struct sakura_stats {
+	const gchar *name;
+	guint64 count;
+	guint64 total;
+	guint64 max;
+	guint32 buckets[STATS_BUCKETS];
+};
+
+struct sakura_stats_scope {
+	struct sakura_stats *stats;
+	gint64 start;
+};
+
+static struct sakura_stats *sakura_stats_get (const char *);
+static void     sakura_stats_record (struct sakura_stats *, gint64);
+static void     sakura_stats_scope_end (struct sakura_stats_scope *);
+static void     sakura_stats_dump (void);
+
+#define STATS_SCOPE(name) \
+	static struct sakura_stats *stats_scope_stats; \
+	struct sakura_stats_scope stats_scope __attribute__((cleanup(sakura_stats_scope_end))) = { \
+		stats_scope_stats ? stats_scope_stats : (stats_scope_stats = sakura_stats_get(name)), \
+		g_get_monotonic_time() }
+#else
+#define STATS_SCOPE(name)
+#endif
+
+static GHashTable *callbacks;     /* struct sakura_callback by name */
+static const char *callback_names[CALLBACK_MAX_DEPTH];
+#ifdef SAKURA_CALLBACK_STATS
+static gint64 callback_starts[CALLBACK_MAX_DEPTH];
+#endif
+static guint callback_depth;
+/* Name of the running handler, NULL if none. Only written by the main thread, so its
+ * signal handlers can read it */
+static const char * volatile callback_current;
+
 #define PALETTE_SIZE 16
 
 /* 16 color palettes in GdkRGBA format (red, green, blue, alpha) */
@@ -238,12 +395,8 @@ struct scheme predefined_schemes[NUM_SCHEMES] = {
 /* CSS definitions. Global CSS is empty, just drop here you CSS to personalize widgets */
 #define SAKURA_CSS ""
 
-#define FADE_WINDOW_CSS "\
-window#fade_window {\
-	background-color: black;\
-} "
-
-#define FADE_WINDOW_OPACITY 0.5
+/* How much colors are dimmed (blended with black) when the window loses the focus */
+#define FADE_AMOUNT 0.5
 
 #define NUM_COLORSETS 6
 #define PCRE2_CODE_UNIT_WIDTH 8
@@ -258,13 +411,57 @@ typedef enum {
 	SHOW_TAB_BAR_NEVER
 } ShowTabBar;
 
+typedef enum {
+	LINK_URL,
+	LINK_MAIL,
+	LINK_MATCHER             /* User defined matcher from the [matchers] group */
+} LinkType;
+
+/* Compiled search regex, cached to not compile it again when repeating searches */
+struct sakura_search_regex {
+	gchar *pattern;
+	guint32 flags;
+	VteRegex *regex;
+};
+
+/* User defined match rule */
+struct sakura_matcher {
+	gchar *name;
+	gchar *pattern;
+	gchar *action;           /* open:URI_TEMPLATE, exec:COMMAND or copy. %s is replaced by the matched text */
+	gint priority;           /* Higher priorities are checked first */
+	GRegex *regex;           /* Full match regex, to know which matcher matched */
+};
+
+/* Startup phases, printed with --startup-trace */
+typedef enum {
+	STARTUP_OPTIONS,
+	STARTUP_CONFIG,
+	STARTUP_GTK_INIT,
+	STARTUP_ICON,
+	STARTUP_REGEX,
+	STARTUP_FIRST_TAB,
+	STARTUP_MAP,
+	STARTUP_SPAWN,
+	STARTUP_OUTPUT
+} StartupPhase;
+
+static const char * const startup_phase_names[] = {
+	"options", "config", "gtk_init", "icon", "regex", "first_tab", "map", "spawn", "output"
+};
+
+typedef enum {
+	LINK_DETECTION_HOVER,    /* Links are matched all the time */
+	LINK_DETECTION_MODIFIER, /* Only while the open url accelerator is held, or when clicking */
+	LINK_DETECTION_OFF
+} LinkDetection;
+
 
 /* Global sakura data */
 static struct {
 	GtkWidget *main_window;
 	GtkWidget *notebook;
 	GtkWidget *menu;
-	GtkWidget *fade_window;  /* Window used for fading effect */
 	PangoFontDescription *font;
 	gdouble line_height; /* Font line height */
 	GdkRGBA forecolors[NUM_COLORSETS];
@@ -273,8 +470,21 @@ static struct {
 	guint schemes[NUM_COLORSETS];  /* Selected color scheme for each colorset */
 	const GdkRGBA *palette;
 	guint palette_idx;
+	GdkRGBA faded_forecolors[NUM_COLORSETS];  /* Dimmed colors, used when the window is unfocused */
+	GdkRGBA faded_backcolors[NUM_COLORSETS];
+	GdkRGBA faded_curscolors[NUM_COLORSETS];
+	GdkRGBA faded_palette[PALETTE_SIZE];
 	gint last_colorset;
 	char *current_match;
+	const struct sakura_matcher *current_matcher; /* Matcher for current_match, NULL for URLs and mails */
+	GPtrArray *matchers;             /* User defined matchers, sorted by priority */
+	GPtrArray *matcher_vteregexps;   /* Combined regex for the matchers, and the ones that can't be combined */
+	GQueue *search_cache;            /* LRU of compiled search regexes, most recently used first */
+	GQueue *search_history;          /* Searched patterns, most recent first */
+	GtkWidget *clipboard_vte;        /* Terminal whose selection is offered as CLIPBOARD, NULL if not owned */
+	gchar *clipboard_text;           /* Its selection, NULL until somebody asks for it */
+	bool clipboard_stale;            /* The selection has changed since the CLIPBOARD was claimed */
+	guint clipboard_watch_id;        /* Gets the selection text before new output can change it */
 	guint width;
 	guint height;
 	glong columns;
@@ -282,6 +492,17 @@ static struct {
 	gint scroll_lines;
 	VteCursorShape cursor_type;
 	ShowTabBar show_tab_bar;         /* Show the tab bar: always, multiple, never */
+	LinkDetection link_detection;    /* When URLs and mail addresses are matched: hover, modifier, off */
+	bool hyperlinks;                 /* Allow OSC 8 hyperlinks */
+	bool osc52;                      /* Relay the tabs output to allow OSC 52 clipboard writes */
+	gint osc52_max_size;             /* Maximum decoded OSC 52 payload */
+	gint hyperlink_max_length;       /* Longer hyperlink URIs are ignored */
+	gint tail_lines;                 /* Lines shown when a file is followed */
+	bool recording;                  /* Relay the tabs output so they can be recorded */
+	bool recording_gzip;             /* Compress the recordings */
+	GPtrArray *recorders;            /* Recorders whose writer thread has not been joined */
+	gint watchdog_threshold;         /* Log main loop stalls longer than this (ms), 0 to disable */
+	struct sakura_watchdog *watchdog;
 	bool show_scrollbar;
 	bool show_closebutton;
 	bool new_tab_after_current;
@@ -297,16 +518,36 @@ static struct {
 	bool resized;
 	bool disable_numbered_tabswitch; /* For disabling direct tabswitching key */
 	bool use_fading;                 /* Fade the window when the focus change */
+	bool faded;                      /* Terminals are using the dimmed colors */
+	bool rgba_visual;                /* Main window is using the RGBA visual */
 	bool scrollable_tabs;
 	bool bold_is_bright;             /* Show bold characters as bright */
 	bool dont_save;                  /* Don't save config file */
 	bool first_run;                  /* To only execute commands first time sakura is launched */
+	bool iconified;                  /* Main window is iconified or withdrawn */
+	bool obscured;                   /* Main window is fully covered by other windows */
+	bool recreating_window;          /* Main window is being recreated with another visual */
+	bool suspended;                  /* Nobody can see us: no blinking, drawing or title updates */
+	bool has_focus;                  /* Main window has the keyboard focus */
+	bool low_power;                  /* Avoid wakeups: no blinking when unfocused, no config file monitor */
+	bool throughput;                 /* Throughput profile: trade features for output speed */
+	bool command_profile;            /* --profile given with -x/-e, it overrides the config in the command tabs */
+	bool command_throughput;         /* Throughput profile for the -x/-e command tabs, if command_profile */
 	GtkWidget *item_copy_link;       /* We include here only the items which need to be hidden */
 	GtkWidget *item_open_link;
 	GtkWidget *item_open_mail;
 	GtkWidget *open_link_separator;
+	GtkWidget *item_osc52;
+	GtkWidget *item_record;
 	GKeyFile *cfg;
 	char *configfile;
+	time_t config_mtime;             /* Config file modification time, used when there's no file monitor */
+	guint housekeeping_id;           /* Periodic timer for all sakura housekeeping tasks */
+	GHashTable *wakeups;             /* Wakeup statistics: poll() wakeups per file descriptor */
+	guint wakeups_total;
+	GPollFunc default_poll;
+	gint64 startup_time;             /* Monotonic time at the start of main */
+	guint startup_traced;            /* Startup phases already printed, one bit each */
 	char *icon;
 	char *shell_path;
 	char *main_title;		/* Main window static title from user input */
@@ -330,6 +571,7 @@ static struct {
 	gint next_tab_key;
 	gint copy_key;
 	gint paste_key;
+	gint paste_file_key;
 	gint scrollbar_key;
 	gint set_tab_name_key;
 	gint search_key;
@@ -347,6 +589,151 @@ static struct {
 	char *argv[3];
 } sakura;
 
+#define OSC52_INTRODUCER "\033]52;"
+#define OSC52_SELECTION_MAX 16
+#define RELAY_BUFFER_SIZE (64*1024)
+#define FEED_BUFFER_SIZE (64*1024)
+#define TAIL_READ_MAX (16*FEED_BUFFER_SIZE) /* Read more in an idle callback */
+#define DEFAULT_TAIL_LINES 10
+#define DEFAULT_SERIAL_BAUDS 115200
+#define RECORDER_RING_SIZE (8*1024*1024) /* Must be a power of two */
+#define RECORDER_BUFFER_SIZE (64*1024)
+#define WATCHDOG_SIGNAL SIGUSR2
+#define WATCHDOG_MAX_FRAMES 64
+#define WATCHDOG_LOG_SIZE (256*1024)  /* The log is rotated, only the last two are kept */
+
+/* OSC 52 parser states */
+typedef enum {
+	OSC52_NONE,
+	OSC52_INTRO,        /* Reading the ESC ] 5 2 ; introducer */
+	OSC52_SELECTION,    /* Reading the selection parameter */
+	OSC52_DATA,         /* Reading the base64 payload */
+	OSC52_DATA_ESC      /* ESC in the payload, it should be the ST terminator */
+} Osc52State;
+
+/* Output relay. Relayed tabs read the child pty themselves instead of VTE, so the
+ * output can be filtered before feeding it to the terminal (OSC 52 sequences) */
+struct sakura_relay {
+	struct sakura_tab *sk_tab;  /* NULL when the tab has been closed */
+	VtePty *pty;
+	guint read_id;              /* Source for the child output */
+	guint write_id;             /* Source to write the pending input when the pty is writable */
+	guint child_watch_id;
+	GByteArray *pending;        /* Input not written to the pty yet */
+	glong rows, columns;        /* Size of the pty */
+	Osc52State osc52_state;
+	guint osc52_intro;          /* Introducer chars already matched */
+	gchar osc52_selection[OSC52_SELECTION_MAX+1];
+	guint osc52_selection_len;
+	GByteArray *osc52_data;     /* Decoded payload */
+	gint osc52_base64_state;
+	guint osc52_base64_save;
+	bool osc52_discard;         /* Payload too big, a query or invalid: ignore the sequence */
+	bool spawning;              /* Waiting for vte_pty_spawn_async */
+};
+
+/* Tabs without a child process show the contents of a stream, and can write the input to another one */
+struct sakura_feed {
+	struct sakura_tab *sk_tab;  /* NULL once the tab is closed */
+	GInputStream *stream;
+	GOutputStream *output;      /* NULL if the tab doesn't take input */
+	GIOStream *connection;      /* Socket connection owning the streams */
+	GCancellable *cancellable;
+	GByteArray *converted;      /* Output with the newlines converted */
+	GByteArray *pending;        /* Input waiting for the write in progress */
+	GBytes *writing_bytes;      /* Input being written */
+	bool cr;                    /* Last byte fed was a carriage return */
+	bool raw;                   /* The output comes from a tty, don't convert the newlines */
+	bool reading;               /* Async operations in progress, they need the feed */
+	bool writing;
+	/* Followed file, for --tail. The stream is NULL then */
+	gchar *path;
+	GFileMonitor *monitor;
+	gint fd;
+	dev_t dev;                  /* To find out if the file has been rotated */
+	ino_t ino;
+	goffset offset;             /* Bytes already fed */
+	guint idle_id;
+};
+
+/* Tab recording in asciicast v2 format. The main thread puts the events in a single producer,
+ * single consumer ring, and a thread writes them to disk */
+struct sakura_recorder {
+	guint8 *ring;
+	gint head;                  /* Only written by the main thread */
+	gint tail;                  /* Only written by the writer thread */
+	gint sleeping;              /* The writer thread is waiting for events */
+	gint stopping;
+	guint dropped;              /* Events dropped because the ring was full */
+	GMutex mutex;
+	GCond cond;
+	GThread *thread;
+	gchar *dir;
+	gchar *filename;
+	gchar *term;
+	gchar *error;               /* Set by the writer thread, shown when it's joined */
+	bool gzip;
+	glong columns;
+	glong rows;
+	gint64 start;               /* Monotonic time of the start, in microseconds */
+	gint64 timestamp;           /* Wall clock time of the start, in seconds */
+	glong last_columns;         /* Last size recorded, only used by the main thread */
+	glong last_rows;
+};
+
+/* Stall watchdog. The main loop pets it from a high priority timeout; when it's not
+ * petted in time, the watchdog thread signals the main thread to get its stack */
+struct sakura_watchdog {
+	GThread *thread;
+	pthread_t main_thread;
+	gint threshold;             /* Milliseconds */
+	guint pet;                  /* Last pet, in milliseconds since the start of sakura */
+	guint timeout_id;
+	gchar *log;
+	sem_t captured;             /* Posted by the signal handler */
+	void *frames[WATCHDOG_MAX_FRAMES];
+	int nframes;
+	gint depth;                 /* Main loop depth at the last pet, bigger than 1 in dialogs */
+	const char *callback;       /* Signal handler running when the stack was captured */
+};
+
+/* Every event in the ring is a header followed by its data */
+struct sakura_record_header {
+	gint64 time;                /* Microseconds since the start */
+	guint32 len;
+	gchar type;                 /* 'o' output, 'i' input, 'r' resize */
+};
+
+/* Big pastes are written in chunks, when the pty can take them */
+struct sakura_paste_piece {
+	GBytes *bytes;          /* Clipboard text, or the last part read from the file */
+	gsize offset;           /* Bytes already written */
+	bool raw;               /* Write the bytes as they are, don't paste them as text */
+	GInputStream *stream;   /* Pasted file, read in parts. NULL for the other pieces */
+	gint bracket;           /* 1 for the bracketed paste start sequence, -1 for the end one */
+};
+
+struct sakura_paste {
+	struct sakura_tab *sk_tab;
+	GQueue *pieces;
+	guint64 total;      /* Bytes of all the pieces */
+	guint64 written;
+	guint64 unread;     /* Bytes of the files not read yet */
+	guint watch_id;
+	GCancellable *cancellable;
+	bool reading;       /* Reading the next part of a file */
+	guint percent;      /* Progress shown in the tab label */
+	gchar *label;       /* Tab label without the progress */
+	bool bracket_open;  /* A bracketed paste start sequence is written, but not its end */
+};
+
+/* Clipboard contents set by OSC 52 */
+struct sakura_clipboard_request {
+	gchar *text;
+	bool clipboard;
+	bool primary;
+};
+
 /* Data associated to each sakura tab */
 struct sakura_tab {
 	GtkWidget *hbox;
@@ -358,6 +745,16 @@ struct sakura_tab {
 	int colorset;
 	GPid pid;           /* pid of the forked process */
 	gulong exit_handler_id;
+	bool title_pending; /* Title changed while sakura was suspended */
+	bool throughput;    /* Using the throughput profile */
+	bool matching;      /* Link regexes are added to the terminal */
+	int http_tag;       /* Tags returned by vte for the link regexes */
+	int mail_tag;
+	struct sakura_relay *relay; /* Output relay, NULL if VTE reads the pty */
+	struct sakura_paste *paste; /* Paste in progress, NULL if none */
+	struct sakura_feed *feed;   /* Stream shown in the tab, NULL if it has a child */
+	struct sakura_recorder *recorder; /* NULL if the tab is not being recorded */
+	bool osc52;         /* Allow OSC 52 clipboard writes */
 };
 
 
@@ -366,7 +763,19 @@ struct sakura_tab {
 #define DEFAULT_SCROLL_LINES 4096
 #define HTTP_REGEXP "(ftp|http)s?://[^ \t\n\b]+[^.,!? \t\n\b()<>{}«»„“”‚‘’\\[\\]\'\"]"
 #define MAIL_REGEXP "[^ \t\n\b()<>{}«»„“”‚‘’\\[\\]\'\"][^ \t\n\b]*@([^ \t\n\b()<>{}«»„“”‚‘’\\[\\]\'\"]+\\.)+([a-zA-Z]{2,})"
-#define DEFAULT_CONFIGFILE "sakura.conf"
+/* Backreferences are numbered, so patterns using them can't be combined with other patterns */
+#define BACKREF_REGEXP "\\\\[1-9]|\\\\g|\\\\k|\\(\\?P="
+#define MATCHERS_GROUP "matchers"
+#define SEARCH_CACHE_SIZE 8
+#define DEFAULT_HYPERLINK_MAX_LENGTH 2048
+#define HYPERLINK_MAX_LENGTH_LIMIT (64*1024)
+#define DEFAULT_OSC52_MAX_SIZE (1024*1024)
+#define SEARCH_HISTORY_SIZE 20
+#define PASTE_CHUNK_SIZE (16*1024)
+#define PASTE_READ_SIZE (64*1024)
+#define BRACKETED_PASTE_START "\033[200~"
+#define BRACKETED_PASTE_END "\033[201~"
+/* Characters with a special meaning in PCRE2 patterns */
 #define DEFAULT_COLUMNS 80
 #define DEFAULT_ROWS 24
 #define DEFAULT_MIN_WIDTH_CHARS 20
@@ -375,8 +784,6 @@ struct sakura_tab {
 #define DEFAULT_LINE_HEIGHT 1.0
 #define FONT_MINIMAL_SIZE (PANGO_SCALE*6)
 #define DEFAULT_WORD_CHARS "-,./?%&#_~:"
-#define TAB_MAX_SIZE 40
-#define TAB_MIN_SIZE 6
 #define FORWARD 1
 #define BACKWARDS 2
 #define DEFAULT_ADD_TAB_ACCELERATOR  (GDK_CONTROL_MASK|GDK_SHIFT_MASK)
@@ -397,6 +804,7 @@ struct sakura_tab {
 #define DEFAULT_NEXT_TAB_KEY  GDK_KEY_Right
 #define DEFAULT_COPY_KEY  GDK_KEY_C
 #define DEFAULT_PASTE_KEY  GDK_KEY_V
+#define DEFAULT_PASTE_FILE_KEY  GDK_KEY_P
 #define DEFAULT_SCROLLBAR_KEY  GDK_KEY_S
 #define DEFAULT_SET_TAB_NAME_KEY  GDK_KEY_N
 #define DEFAULT_SEARCH_KEY  GDK_KEY_F
@@ -407,6 +815,15 @@ struct sakura_tab {
 #define DEFAULT_SCROLLABLE_TABS TRUE
 #define DEFAULT_PASTE_BUTTON 2
 #define DEFAULT_MENU_BUTTON 3
+#define HOUSEKEEPING_INTERVAL 1 /* seconds */
+/* Per tab memory estimate. A screen cell takes 16 bytes in vte, the scrollback is kept as
+ * text plus some bookkeeping per row. The rest (widgets, pty, vte buffers) is a rough
+ * figure, check it with sakura-bench --memory */
+#define MEMORY_CELL_SIZE 16
+#define MEMORY_SCROLLBACK_ROW_SIZE 16
+#define MEMORY_TAB_OVERHEAD (256*1024)
+#define PROFILE_DEFAULT "default"
+#define PROFILE_THROUGHPUT "throughput"
 
 /* make this an array instead of #defines to get a compile time
  * error instead of a runtime if NUM_COLORSETS changes */
@@ -451,22 +868,49 @@ static GQuark term_data_id = 0;
 
 /* Spawn callback */
 void sakura_spawn_callback (VteTerminal *, GPid, GError *, gpointer);
+/* Relay callbacks */
+static void     sakura_relay_spawn_cb (GObject *, GAsyncResult *, gpointer);
+static gboolean sakura_relay_read_cb (gint, GIOCondition, gpointer);
+static gboolean sakura_relay_write_cb (gint, GIOCondition, gpointer);
+static void     sakura_relay_child_watch_cb (GPid, gint, gpointer);
+static void     sakura_relay_commit_cb (VteTerminal *, gchar *, guint, gpointer);
+static void     sakura_relay_size_allocate_cb (GtkWidget *, GdkRectangle *, gpointer);
+static gboolean sakura_osc52_idle_cb (gpointer);
+static gboolean sakura_paste_write_cb (gint, GIOCondition, gpointer);
+static void     sakura_feed_read_cb (GObject *, GAsyncResult *, gpointer);
+static void     sakura_feed_write_cb (GObject *, GAsyncResult *, gpointer);
+static void     sakura_feed_commit_cb (VteTerminal *, gchar *, guint, gpointer);
+static void     sakura_socket_connected_cb (GObject *, GAsyncResult *, gpointer);
+static gboolean sakura_recorder_reap_cb (gpointer);
+static void     sakura_tail_changed_cb (GFileMonitor *, GFile *, GFile *, GFileMonitorEvent, gpointer);
+static gboolean sakura_tail_idle_cb (gpointer);
 /* VTE callbacks */
 static gboolean sakura_term_buttonpressed_cb (GtkWidget *, GdkEventButton *, gpointer);
 static gboolean sakura_term_buttonreleased_cb (GtkWidget *, GdkEventButton *, gpointer);
+static gboolean sakura_term_selection_press_cb (GtkWidget *, GdkEventButton *, gpointer);
+static void     sakura_selection_changed_cb (GtkWidget *, void *);
+#if VTE_CHECK_VERSION(0, 72, 0)
+static void     sakura_clipboard_get_cb (GtkClipboard *, GtkSelectionData *, guint, gpointer);
+static void     sakura_clipboard_clear_cb (GtkClipboard *, gpointer);
+#endif
 static void     sakura_beep_cb (GtkWidget *, void *);
 static void     sakura_increase_font_cb (GtkWidget *, void *);
 static void     sakura_decrease_font_cb (GtkWidget *, void *);
 static void     sakura_child_exited_cb (GtkWidget *, void *);
 static void     sakura_eof_cb (GtkWidget *, void *);
 static void     sakura_title_changed_cb (GtkWidget *, void *);
+static void     sakura_hyperlink_hover_cb (GtkWidget *, const char *, GdkRectangle *, void *);
+static gboolean sakura_term_draw_cb (GtkWidget *, cairo_t *, void *);
 static gboolean sakura_delete_event_cb (GtkWidget *, void *);
 static void     sakura_destroy_window_cb (GtkWidget *, void *);
 /* Main window callbacks */
 static gboolean sakura_key_press_cb (GtkWidget *, GdkEventKey *, gpointer);
+static gboolean sakura_key_release_cb (GtkWidget *, GdkEventKey *, gpointer);
 static gboolean sakura_resized_window_cb (GtkWidget *, GdkEventConfigure *, void *);
 static gboolean sakura_focus_in_cb (GtkWidget *, GdkEvent *, void *);
 static gboolean sakura_focus_out_cb (GtkWidget *, GdkEvent *, void *);
+static gboolean sakura_window_state_cb (GtkWidget *, GdkEventWindowState *, void *);
+static gboolean sakura_visibility_cb (GtkWidget *, GdkEventVisibility *, void *);
 static void     sakura_conf_changed_cb (GtkWidget *, void *);
 static void     sakura_show_event_cb (GtkWidget *, gpointer);
 /* Notebook, notebook labels and notebook buttons callbacks */
@@ -489,6 +933,9 @@ static void     sakura_open_mail_cb (GtkWidget *, void *);
 static void     sakura_copy_url_cb (GtkWidget *, void *);
 static void     sakura_copy_cb (GtkWidget *, void *);
 static void     sakura_paste_cb (GtkWidget *, void *);
+static void     sakura_paste_file_cb (GtkWidget *, void *);
+static void     sakura_open_log_cb (GtkWidget *, void *);
+static void     sakura_record_cb (GtkWidget *, void *);
 static void     sakura_show_tab_bar_cb (GtkWidget *, void *);
 static void     sakura_tabs_on_bottom_cb (GtkWidget *, void *);
 static void     sakura_less_questions_cb (GtkWidget *, void *);
@@ -496,7 +943,8 @@ static void     sakura_copy_on_select_cb (GtkWidget *, void *);
 static void     sakura_new_tab_after_current_cb (GtkWidget *, void *);
 static void     sakura_show_scrollbar_cb (GtkWidget *, void *);
 static void     sakura_disable_numbered_tabswitch_cb (GtkWidget *, void *);
-//static void     sakura_use_fading_cb (GtkWidget *, void *);
+static void     sakura_use_fading_cb (GtkWidget *, void *);
+static void     sakura_osc52_cb (GtkWidget *, void *);
 static void     sakura_setname_entry_changed_cb (GtkWidget *, void *);
 static void     sakura_set_cursor_cb (GtkWidget *, void *);
 static void     sakura_blinking_cursor_cb (GtkWidget *, void *);
@@ -509,14 +957,34 @@ static void     sakura_build_command (int *, char ***);
 static char *   sakura_get_term_cwd (struct sakura_tab *);
 static char *   sakura_get_term_cwd_osc7 (struct sakura_tab *);
 static guint    sakura_tokeycode (guint key);
+static GdkModifierType sakura_keyval_to_modifier (guint);
 static void     sakura_set_keybind (const gchar *, guint);
 static guint    sakura_get_keybind (const gchar *);
-static void     sakura_sanitize_working_directory (void);
+static void     sakura_sanitize_working_directory (void) MAIN_ONLY;
+static gint     sakura_wakeup_poll (GPollFD *, guint, gint);
+static gchar *  sakura_wakeup_fd_name (gint);
+static void     sakura_wakeup_report (void);
+static void     sakura_startup_trace (StartupPhase);
+static gboolean sakura_startup_map_cb (GtkWidget *, GdkEvent *, gpointer);
+static void     sakura_startup_output_cb (VteTerminal *, gpointer);
+static void     sakura_startup_tab_added (void) MAIN_ONLY;
+static gsize    sakura_tab_memory (struct sakura_tab *, glong *);
+static bool     sakura_process_memory (gsize *, gsize *);
+static void     sakura_memory_dump (void);
+static gboolean sakura_dump_cb (gpointer);
+static void     sakura_trace_init (void) MAIN_ONLY;
+static void     sakura_trace_dump (int);
+static void     sakura_trace_crash_signal (int);
+static gsize    sakura_trace_append (char *, gsize, const char *, gint64, int);
+static gboolean sakura_label_query_tooltip_cb (GtkWidget *, gint, gint, gboolean, GtkTooltip *, gpointer);
+static gboolean sakura_housekeeping_cb (gpointer);
 
 /* Functions */
+static void     sakura_load_config (void);
 static void     sakura_init ();
 static void     sakura_init_popup ();
 static void     sakura_add_tab ();
+static struct sakura_tab * sakura_new_tab (bool);
 static void     sakura_del_tab (gint);
 static void     sakura_close_tab (gint); /* Save config, del tab and destroy sakura */
 static void     sakura_destroy ();
@@ -528,11 +996,95 @@ static void     sakura_set_size (void);
 static void     sakura_config_done ();
 static void     sakura_set_colorset (int);
 static void     sakura_set_colors (void);
+static void     sakura_set_tab_colors (struct sakura_tab *);
+static void     sakura_set_suspended (void);
+static void     sakura_set_faded (bool);
+static void     sakura_spawn (struct sakura_tab *, const char *, char **, char **, GSpawnFlags);
+static gint     sakura_tab_get_pty_fd (struct sakura_tab *);
+static void     sakura_relay_write (struct sakura_relay *, const char *, gsize);
+static void     sakura_relay_output (struct sakura_relay *, const char *, gsize);
+static void     sakura_relay_detach (struct sakura_relay *);
+static void     sakura_relay_free (struct sakura_relay *);
+static void     sakura_osc52_finish (struct sakura_relay *);
+static void     sakura_set_link_matching (struct sakura_tab *, bool);
+static void     sakura_disable_link_matching (void);
+static char *   sakura_check_link (struct sakura_tab *, GdkEvent *, LinkType *);
+static void     sakura_load_matchers (void);
+static VteRegex * sakura_new_jit_regex (const char *, GError **);
+static gint     sakura_matcher_compare (gconstpointer, gconstpointer);
+static const struct sakura_matcher * sakura_find_matcher (const char *);
+static void     sakura_run_matcher (const struct sakura_matcher *, const char *);
+static void     sakura_open_uri (const char *);
+static void     sakura_fade_color (GdkRGBA *, const GdkRGBA *);
+static bool     sakura_uses_transparency (void);
+static void     sakura_set_visual (bool);
+static void     sakura_set_windowid (bool);
+static void     sakura_set_cursor_blink (void);
 static void     sakura_search_dialog (void);
 static void     sakura_search (const char *, bool);
+static VteRegex * sakura_get_search_regex (const char *, guint32, GError **);
+static void     sakura_add_search_history (const char *);
 static void     sakura_copy (void);
+static void     sakura_copy_on_select (struct sakura_tab *);
+static void     sakura_clipboard_fetch (void);
+#if VTE_CHECK_VERSION(0, 72, 0)
+static void     sakura_clipboard_watch (struct sakura_tab *);
+static gboolean sakura_clipboard_watch_cb (gint, GIOCondition, gpointer);
+#endif
 static void     sakura_paste (void);
 static void     sakura_paste_primary (void);
+static void     sakura_paste_selection (struct sakura_tab *, GdkAtom);
+#if VTE_CHECK_VERSION(0, 68, 0)
+static void     sakura_paste_received_cb (GtkClipboard *, const gchar *, gpointer);
+static void     sakura_paste_text (struct sakura_tab *, const gchar *, gsize);
+static void     sakura_paste_bytes (struct sakura_tab *, GBytes *);
+#endif
+static struct sakura_paste *sakura_paste_get (struct sakura_tab *);
+static void     sakura_paste_marker (struct sakura_tab *, gint);
+static void     sakura_paste_stream (struct sakura_tab *, GInputStream *, goffset);
+static void     sakura_paste_schedule (struct sakura_paste *);
+static gboolean sakura_paste_idle_cb (gpointer);
+static bool     sakura_paste_takes_input (struct sakura_tab *);
+static bool     sakura_paste_write (struct sakura_paste *);
+static void     sakura_paste_read_cb (GObject *, GAsyncResult *, gpointer);
+static void     sakura_paste_chunk (struct sakura_tab *, const gchar *, gsize, bool);
+static void     sakura_paste_piece_free (gpointer);
+static void     sakura_paste_file (struct sakura_tab *, const gchar *, bool);
+static void     sakura_paste_file_dialog (void);
+static struct sakura_feed * sakura_feed_new (struct sakura_tab *);
+static void     sakura_feed_stream (struct sakura_tab *, GInputStream *);
+static void     sakura_feed_start (struct sakura_feed *, GInputStream *, GOutputStream *);
+static void     sakura_feed_write (struct sakura_feed *);
+static void     sakura_serial_tab (const gchar *) MAIN_ONLY;
+static void     sakura_socket_tab (const gchar *) MAIN_ONLY;
+static speed_t  sakura_bauds_to_speed (gint);
+static void     sakura_record_start (struct sakura_tab *);
+static void     sakura_record_stop (struct sakura_tab *);
+static void     sakura_record_event (struct sakura_tab *, gchar, const char *, gsize);
+static void     sakura_record_size_allocate_cb (GtkWidget *, GdkRectangle *, gpointer);
+static void     sakura_ring_put (struct sakura_recorder *, guint, const void *, gsize);
+static void     sakura_ring_get (struct sakura_recorder *, guint, void *, gsize);
+static gpointer sakura_recorder_thread (gpointer);
+static void     sakura_recorder_escape (GString *, GByteArray *, const guint8 *, gsize);
+static void     sakura_recorder_free (struct sakura_recorder *);
+static void     sakura_recorders_wait (void);
+static gchar *  sakura_state_dir (void);
+static void     sakura_watchdog_start (gint);
+static gboolean sakura_watchdog_pet_cb (gpointer);
+static gpointer sakura_watchdog_thread (gpointer);
+static void     sakura_watchdog_signal (int);
+static guint    sakura_watchdog_now (void);
+static void     sakura_watchdog_log (struct sakura_watchdog *, guint, bool, bool);
+static void     sakura_tail_file (const gchar *);
+static bool     sakura_tail_open (struct sakura_feed *, bool);
+static goffset  sakura_tail_start (gint, goffset, gint);
+static void     sakura_tail_read (struct sakura_feed *);
+static void     sakura_open_log_dialog (void);
+static void     sakura_feed_output (struct sakura_feed *, const guint8 *, gsize);
+static void     sakura_feed_free (struct sakura_feed *);
+static void     sakura_feed_stop (struct sakura_tab *);
+static void     sakura_paste_show_progress (struct sakura_paste *);
+static void     sakura_paste_stop (struct sakura_tab *);
 static void     sakura_show_scrollbar (void);
 static void     sakura_new_window (void);
 
@@ -554,6 +1106,13 @@ static char *option_config_file;
 static gboolean option_fullscreen;
 static gboolean option_maximize;
 static gint option_colorset;
+static gboolean option_wakeup_stats;
+static gboolean option_startup_trace;
+static const char *option_profile;
+static gboolean option_stdin;
+static gchar **option_tail;
+static gchar **option_serial;
+static gchar **option_socket;
 
 
 static GOptionEntry entries[] = {
@@ -574,6 +1133,13 @@ static GOptionEntry entries[] = {
 	{ "fullscreen", 's', 0, G_OPTION_ARG_NONE, &option_fullscreen, N_("Fullscreen mode"), NULL },
 	{ "config-file", 0, 0, G_OPTION_ARG_FILENAME, &option_config_file, N_("Use alternate configuration file"), NULL },
 	{ "colorset", 0, 0, G_OPTION_ARG_INT, &option_colorset, N_("Select initial colorset"), NULL },
+	{ "wakeup-stats", 0, 0, G_OPTION_ARG_NONE, &option_wakeup_stats, N_("Print main loop wakeups per second"), NULL },
+	{ "startup-trace", 0, 0, G_OPTION_ARG_NONE, &option_startup_trace, N_("Print the time taken by each startup phase"), NULL },
+	{ "profile", 0, 0, G_OPTION_ARG_STRING, &option_profile, N_("Use a performance profile (default or throughput)"), NULL },
+	{ "stdin", 0, 0, G_OPTION_ARG_NONE, &option_stdin, N_("Show the standard input in the first tab, without a shell"), NULL },
+	{ "tail", 0, 0, G_OPTION_ARG_FILENAME_ARRAY, &option_tail, N_("Follow a file in a new tab, like tail -F (can be repeated)"), N_("FILE") },
+	{ "serial", 0, 0, G_OPTION_ARG_STRING_ARRAY, &option_serial, N_("Attach a new tab to a serial device (can be repeated)"), N_("DEVICE[,BAUDS]") },
+	{ "socket", 0, 0, G_OPTION_ARG_STRING_ARRAY, &option_socket, N_("Attach a new tab to a socket (can be repeated)"), N_("unix:PATH|tcp:HOST:PORT") },
 	{ NULL }
 };
 
@@ -587,12 +1153,36 @@ sakura_key_press_cb (GtkWidget *widget, GdkEventKey *event, gpointer user_data)
 {
 	gint page, npages;
 	guint topage = 0;
+	struct sakura_tab *sk_tab;
 
 	if (event->type != GDK_KEY_PRESS) return FALSE;
 
 	page = gtk_notebook_get_current_page(GTK_NOTEBOOK(sakura.notebook));
 	npages = gtk_notebook_get_n_pages(GTK_NOTEBOOK(sakura.notebook));
 
+	/* Match links only while the open url accelerator is held. The pressed key is not in the state yet */
+	if (sakura.link_detection == LINK_DETECTION_MODIFIER) {
+		GdkModifierType state = event->state | sakura_keyval_to_modifier(event->keyval);
+		sk_tab = sakura_get_sktab(sakura, page);
+		sakura_set_link_matching(sk_tab, (state & sakura.open_url_accelerator) == sakura.open_url_accelerator);
+	}
+
+#ifdef SAKURA_CALLBACK_STATS
+	/* Ctrl+Shift+F12 prints the callback statistics */
+	if ((event->state & gtk_accelerator_get_default_mod_mask()) == (GDK_CONTROL_MASK|GDK_SHIFT_MASK) &&
+	    event->keyval == GDK_KEY_F12) {
+		sakura_stats_dump();
+		return TRUE;
+	}
+#endif
+
+	/* Escape cancels the paste in progress */
+	sk_tab = sakura_get_sktab(sakura, page);
+	if (sk_tab->paste && event->keyval == GDK_KEY_Escape) {
+		sakura_paste_stop(sk_tab);
+		return TRUE;
+	}
+
 	/* Use keycodes instead of keyvals. With keyvals, key bindings work only in US/ISO8859-1 and similar locales */
 	guint keycode = event->hardware_keycode;
 
@@ -676,6 +1266,9 @@ sakura_key_press_cb (GtkWidget *widget, GdkEventKey *event, gpointer user_data)
 		} else if (keycode == sakura_tokeycode(sakura.paste_key)) {
 			sakura_paste();
 			return TRUE;
+		} else if (keycode == sakura_tokeycode(sakura.paste_file_key)) {
+			sakura_paste_file_dialog();
+			return TRUE;
 		}
 	}
 
@@ -734,60 +1327,105 @@ sakura_key_press_cb (GtkWidget *widget, GdkEventKey *event, gpointer user_data)
 }
 
 
+/* Stop matching links when the open url accelerator is released */
+static gboolean
+sakura_key_release_cb (GtkWidget *widget, GdkEventKey *event, gpointer user_data)
+{
+	GdkModifierType state;
+
+	if (event->type != GDK_KEY_RELEASE) return FALSE;
+
+	if (sakura.link_detection != LINK_DETECTION_MODIFIER) return FALSE;
+
+	/* The released key is still in the state */
+	state = event->state & ~sakura_keyval_to_modifier(event->keyval);
+	if ((state & sakura.open_url_accelerator) != sakura.open_url_accelerator) {
+		sakura_disable_link_matching();
+	}
+
+	return FALSE;
+}
+
+
 static gboolean
 sakura_resized_window_cb (GtkWidget *widget, GdkEventConfigure *event, void *data)
 {
 	if (event->width != sakura.width || event->height != sakura.height) {
 		//SAY("Configure event received. Current w %d h %d ConfigureEvent w %d h %d",
 		//sakura.width, sakura.height, event->width, event->height);
-		gtk_widget_hide(sakura.fade_window);
 		sakura.resized = TRUE;
 	}
 
 	return FALSE;
 }
 
-/* Use focus-in-event to unmap the fade window */
+/* Use focus-in-event to restore the original colors */
 static gboolean
 sakura_focus_in_cb (GtkWidget *widget, GdkEvent *event, void *data)
 {
 	if (event->type != GDK_FOCUS_CHANGE) return FALSE;
-	//if (!sakura.use_fading) return FALSE;
 
-	/* Got the focus, hide the fade */
-	//gtk_widget_hide(sakura.fade_window);
+	/* Got the focus, remove the fade */
+	sakura_set_faded(false);
 
 	/* Reset urgency hint */
 	gtk_window_set_urgency_hint(GTK_WINDOW(sakura.main_window), FALSE);
 
+	sakura.has_focus = true;
+	if (sakura.low_power) sakura_set_cursor_blink();
+
 	return FALSE;
 }
 
 
-/* Use focus-out-event to map the fade window */
+/* Use focus-out-event to dim the terminal colors */
 static gboolean
 sakura_focus_out_cb (GtkWidget *widget, GdkEvent *event, void *data)
 {
-	gint ax, ay, mx, my, x, y;
-
 	if (event->type != GDK_FOCUS_CHANGE) return FALSE;
+
+	/* Don't blink unfocused cursors in low power mode */
+	sakura.has_focus = false;
+	if (sakura.low_power) sakura_set_cursor_blink();
+
+	/* We won't get the accelerator release event */
+	if (sakura.link_detection == LINK_DETECTION_MODIFIER) sakura_disable_link_matching();
+
 	if (!sakura.use_fading) return FALSE;
 
 	/* No fade when the menu is displayed */
 	if (gtk_widget_is_visible(sakura.menu)) return FALSE;
 
-	/* Give the right size and position to the fade_window to cover all the main window */
-	gtk_widget_translate_coordinates(sakura.notebook, sakura.main_window, 0, 0, &ax, &ay);
-	gtk_window_get_position(GTK_WINDOW(sakura.main_window), &mx, &my);
-	gint titlebar_height = ay-my;
-	gtk_window_move(GTK_WINDOW(sakura.fade_window), mx, my+titlebar_height);
-	//SAY("FADE ax %d ay %d x %d y %d titlebar_h %d", ax, ay, mx, my, titlebar_height);
+	sakura_set_faded(true);
+
+	return FALSE;
+}
+
+
+/* Window state changes. Iconified and withdrawn windows are not drawn, so stop working for them */
+static gboolean
+sakura_window_state_cb (GtkWidget *widget, GdkEventWindowState *event, void *data)
+{
+	if (!(event->changed_mask & (GDK_WINDOW_STATE_ICONIFIED|GDK_WINDOW_STATE_WITHDRAWN)))
+		return FALSE;
+
+	/* The window withdrawn to change its visual, see sakura_set_visual */
+	if (sakura.recreating_window || event->window != gtk_widget_get_window(widget))
+		return FALSE;
+
+	sakura.iconified = (event->new_window_state & (GDK_WINDOW_STATE_ICONIFIED|GDK_WINDOW_STATE_WITHDRAWN)) != 0;
+	sakura_set_suspended();
+
+	return FALSE;
+}
 
-	/* Same size as main window */
-	gtk_window_get_size(GTK_WINDOW(sakura.main_window), &x, &y);
-	gtk_window_resize(GTK_WINDOW(sakura.fade_window), x, y);
 
-	//gtk_widget_show_all(sakura.fade_window);
+/* Visibility changes. Only sent when there's no compositor; a fully obscured window is like an iconified one */
+static gboolean
+sakura_visibility_cb (GtkWidget *widget, GdkEventVisibility *event, void *data)
+{
+	sakura.obscured = (event->state == GDK_VISIBILITY_FULLY_OBSCURED);
+	sakura_set_suspended();
 
 	return FALSE;
 }
@@ -855,6 +1493,7 @@ sakura_switch_page_cb (GtkWidget *widget, GtkWidget *widget_page, guint page_num
 	/* Don't use gtk_notebook_get_current_page in the callbacks, it returns the previous page */
 
 	sk_tab = sakura_get_sktab(sakura, page_num);
+	sakura_trace(TRACE_TAB_SWITCH, page_num, 0);
 
 	/* Update the window title when a new tab is selected, but don't when an user title has been set */
 	//if (!sakura.tab_default_title && !sakura.main_title)
@@ -951,22 +1590,84 @@ static gboolean
 sakura_term_buttonreleased_cb (GtkWidget *widget, GdkEventButton *button_event, gpointer user_data)
 {
 
+	struct sakura_tab *sk_tab;
+	gint page;
+
 	if (button_event->type != GDK_BUTTON_RELEASE)
 		return FALSE;
 
 	if (sakura.copy_on_select)
-		if (button_event->button == 1)
-			sakura_copy();
+		if (button_event->button == 1) {
+			page = gtk_notebook_get_current_page(GTK_NOTEBOOK(sakura.notebook));
+			sk_tab = sakura_get_sktab(sakura, page);
+			sakura_copy_on_select(sk_tab);
+		}
+
+	return FALSE;
+}
+
+
+/* Connected before the vte handler: the left button clears the selection we are
+ * offering as CLIPBOARD, so get its text before it's lost */
+static gboolean
+sakura_term_selection_press_cb (GtkWidget *widget, GdkEventButton *button_event, gpointer user_data)
+{
+	if (button_event->button == 1 && widget == sakura.clipboard_vte && !sakura.clipboard_stale) {
+		sakura_clipboard_fetch();
+	}
 
 	return FALSE;
 }
 
 
+static void
+sakura_selection_changed_cb (GtkWidget *widget, void *data)
+{
+	if (widget == sakura.clipboard_vte) {
+		sakura.clipboard_stale = true;
+	}
+}
+
+
+#if VTE_CHECK_VERSION(0, 72, 0)
+/* Somebody wants the CLIPBOARD contents: get the selected text from vte, only the first time */
+static void
+sakura_clipboard_get_cb (GtkClipboard *clipboard, GtkSelectionData *selection_data, guint info, gpointer owner)
+{
+	if (GTK_WIDGET(owner) != sakura.clipboard_vte)
+		return;
+
+	sakura_clipboard_fetch();
+
+	if (sakura.clipboard_text) {
+		gtk_selection_data_set_text(selection_data, sakura.clipboard_text, -1);
+	}
+}
+
+
+static void
+sakura_clipboard_clear_cb (GtkClipboard *clipboard, gpointer owner)
+{
+	if (GTK_WIDGET(owner) != sakura.clipboard_vte)
+		return;
+
+	sakura.clipboard_vte = NULL;
+	g_free(sakura.clipboard_text);
+	sakura.clipboard_text = NULL;
+	if (sakura.clipboard_watch_id) {
+		g_source_remove(sakura.clipboard_watch_id);
+		sakura.clipboard_watch_id = 0;
+	}
+}
+#endif
+
+
 static gboolean
 sakura_term_buttonpressed_cb (GtkWidget *widget, GdkEventButton *button_event, gpointer user_data)
 {
 	struct sakura_tab *sk_tab;
-	gint page, tag;
+	gint page;
+	LinkType link_type;
 
 	if (button_event->type != GDK_BUTTON_PRESS)
 		return FALSE;
@@ -974,8 +1675,13 @@ sakura_term_buttonpressed_cb (GtkWidget *widget, GdkEventButton *button_event, g
 	page = gtk_notebook_get_current_page(GTK_NOTEBOOK(sakura.notebook));
 	sk_tab = sakura_get_sktab(sakura, page);
 
-	/* Find out if cursor it's over a matched expression...*/
-	sakura.current_match = vte_terminal_match_check_event(VTE_TERMINAL(sk_tab->vte), (GdkEvent *) button_event, &tag);
+	/* Find out if cursor it's over a link...*/
+	g_free(sakura.current_match);
+	sakura.current_match = sakura_check_link(sk_tab, (GdkEvent *) button_event, &link_type);
+	sakura.current_matcher = NULL;
+	if (sakura.current_match && link_type == LINK_MATCHER) {
+		sakura.current_matcher = sakura_find_matcher(sakura.current_match);
+	}
 
 	/* Left button with accelerator: open the URL if any */
 	if (button_event->button == 1 &&
@@ -1007,10 +1713,8 @@ sakura_term_buttonpressed_cb (GtkWidget *widget, GdkEventButton *button_event, g
 		if (sakura.current_match) {
 			/* Show the extra options in the menu */
 
-			char *matches;
 			/* Is it a mail address? */
-			if (vte_terminal_event_check_regex_simple(VTE_TERMINAL(sk_tab->vte), (GdkEvent *) button_event,
-								  &sakura.mail_vteregexp, 1, 0, &matches)) {
+			if (link_type == LINK_MAIL) {
 				gtk_widget_show(sakura.item_open_mail);
 				gtk_widget_hide(sakura.item_open_link);
 			} else {
@@ -1019,8 +1723,6 @@ sakura_term_buttonpressed_cb (GtkWidget *widget, GdkEventButton *button_event, g
 			}
 			gtk_widget_show(sakura.item_copy_link);
 			gtk_widget_show(sakura.open_link_separator);
-
-			g_free(matches);
 		} else {
 			/* Hide all the options */
 			gtk_widget_hide(sakura.item_open_mail);
@@ -1029,6 +1731,19 @@ sakura_term_buttonpressed_cb (GtkWidget *widget, GdkEventButton *button_event, g
 			gtk_widget_hide(sakura.open_link_separator);
 		}
 
+		/* Per tab options. Only relayed tabs can handle OSC 52 */
+		g_signal_handlers_block_by_func(sakura.item_osc52, sakura_osc52_cb, NULL);
+		gtk_check_menu_item_set_active(GTK_CHECK_MENU_ITEM(sakura.item_osc52), sk_tab->osc52);
+		g_signal_handlers_unblock_by_func(sakura.item_osc52, sakura_osc52_cb, NULL);
+		gtk_widget_set_sensitive(sakura.item_osc52, sk_tab->relay != NULL);
+		gtk_widget_set_visible(sakura.item_osc52, sakura.osc52);
+		/* Only relayed and child-less tabs see their output */
+		g_signal_handlers_block_by_func(sakura.item_record, sakura_record_cb, NULL);
+		gtk_check_menu_item_set_active(GTK_CHECK_MENU_ITEM(sakura.item_record), sk_tab->recorder != NULL);
+		g_signal_handlers_unblock_by_func(sakura.item_record, sakura_record_cb, NULL);
+		gtk_widget_set_sensitive(sakura.item_record, sk_tab->relay != NULL || sk_tab->feed != NULL);
+		gtk_widget_set_visible(sakura.item_record, sakura.recording);
+
 		gtk_menu_popup_at_pointer(menu, (GdkEvent *) button_event);
 
 		return TRUE;
@@ -1099,6 +1814,7 @@ sakura_child_exited_cb (GtkWidget *widget, void *data)
 				gtk_widget_get_parent(widget));
 	npages = gtk_notebook_get_n_pages(GTK_NOTEBOOK(sakura.notebook));
 	sk_tab = sakura_get_sktab(sakura, page);
+	sakura_trace(TRACE_CHILD_EXIT, page, sk_tab->pid);
 
 	/* Only write configuration to disk if it's the last tab */
 	if (npages==1) {
@@ -1140,6 +1856,12 @@ sakura_title_changed_cb (GtkWidget *widget, void *data)
 	modified_page = sakura_find_tab(vte_term);
 	sk_tab = sakura_get_sktab(sakura, modified_page);
 
+	/* Nobody is looking. Remember it and update the labels when we're visible again */
+	if (sakura.suspended) {
+		sk_tab->title_pending = true;
+		return;
+	}
+
 	tabtitle = vte_terminal_get_window_title(VTE_TERMINAL(sk_tab->vte));
 
 	/* User set values overrides any other one */
@@ -1151,6 +1873,26 @@ sakura_title_changed_cb (GtkWidget *widget, void *data)
 }
 
 
+/* Show the URI of the hovered OSC 8 hyperlink, the link text can be anything */
+static void
+sakura_hyperlink_hover_cb (GtkWidget *widget, const char *uri, GdkRectangle *bbox, void *data)
+{
+	if (uri && strlen(uri) > sakura.hyperlink_max_length) {
+		uri = NULL;
+	}
+
+	gtk_widget_set_tooltip_text(widget, uri);
+}
+
+
+/* Skip VTE drawing while suspended. Terminal contents are still updated, and redrawn when we resume */
+static gboolean
+sakura_term_draw_cb (GtkWidget *widget, cairo_t *cr, void *data)
+{
+	return sakura.suspended;
+}
+
+
 static gboolean
 sakura_delete_event_cb (GtkWidget *widget, void *data)
 {
@@ -1168,7 +1910,7 @@ sakura_delete_event_cb (GtkWidget *widget, void *data)
 		for (i=0; i < npages; i++) {
 
 			sk_tab = sakura_get_sktab(sakura, i);
-			pgid = tcgetpgrp(vte_pty_get_fd(vte_terminal_get_pty(VTE_TERMINAL(sk_tab->vte))));
+			pgid = tcgetpgrp(sakura_tab_get_pty_fd(sk_tab));
 
 			/* If running processes are found, we ask one time and exit */
 			if ( (pgid != -1) && (pgid != sk_tab->pid)) {
@@ -1601,11 +2343,23 @@ sakura_copy_url_cb (GtkWidget *widget, void *data)
 
 static void
 sakura_open_url_cb (GtkWidget *widget, void *data)
+{
+	/* User defined matchers have their own actions */
+	if (sakura.current_matcher) {
+		sakura_run_matcher(sakura.current_matcher, sakura.current_match);
+	} else {
+		sakura_open_uri(sakura.current_match);
+	}
+}
+
+
+static void
+sakura_open_uri (const char *uri)
 {
 	GError *error=NULL;
 	gchar *browser=NULL;
 
-	SAY("Opening %s", sakura.current_match);
+	SAY("Opening %s", uri);
 
 	browser = g_strdup(g_getenv("BROWSER"));
 
@@ -1616,9 +2370,9 @@ sakura_open_url_cb (GtkWidget *widget, void *data)
 	}
 
 	if (browser) {
-		gchar * argv[] = {browser, sakura.current_match, NULL};
+		gchar * argv[] = {browser, (gchar *)uri, NULL};
 		if (!g_spawn_async(".", argv, NULL, G_SPAWN_SEARCH_PATH, NULL, NULL, NULL, &error)) {
-			sakura_error("Couldn't exec \"%s %s\": %s", browser, sakura.current_match, error->message);
+			sakura_error("Couldn't exec \"%s %s\": %s", browser, uri, error->message);
 			g_error_free(error);
 		}
 
@@ -1753,7 +2507,9 @@ sakura_audible_bell_cb (GtkWidget *widget, void *data)
 	sk_tab = sakura_get_sktab(sakura, page);
 
 	if (gtk_check_menu_item_get_active(GTK_CHECK_MENU_ITEM(widget))) {
-		vte_terminal_set_audible_bell (VTE_TERMINAL(sk_tab->vte), TRUE);
+		/* Throughput tabs don't beep */
+		if (!sk_tab->throughput)
+			vte_terminal_set_audible_bell (VTE_TERMINAL(sk_tab->vte), TRUE);
 		sakura_set_config_string("audible_bell", "Yes");
 	} else {
 		vte_terminal_set_audible_bell (VTE_TERMINAL(sk_tab->vte), FALSE);
@@ -1772,9 +2528,13 @@ sakura_blinking_cursor_cb (GtkWidget *widget, void *data)
 	sk_tab = sakura_get_sktab(sakura, page);
 
 	if (gtk_check_menu_item_get_active(GTK_CHECK_MENU_ITEM(widget))) {
-		vte_terminal_set_cursor_blink_mode (VTE_TERMINAL(sk_tab->vte), VTE_CURSOR_BLINK_ON);
+		sakura.blinking_cursor = true;
+		/* Throughput tabs never blink */
+		if (!sk_tab->throughput)
+			vte_terminal_set_cursor_blink_mode (VTE_TERMINAL(sk_tab->vte), VTE_CURSOR_BLINK_ON);
 		sakura_set_config_string("blinking_cursor", "Yes");
 	} else {
+		sakura.blinking_cursor = false;
 		vte_terminal_set_cursor_blink_mode (VTE_TERMINAL(sk_tab->vte), VTE_CURSOR_BLINK_OFF);
 		sakura_set_config_string("blinking_cursor", "No");
 	}
@@ -1840,6 +2600,22 @@ sakura_paste_cb (GtkWidget *widget, void *data)
 }
 
 
+/* Parameters are never used */
+static void
+sakura_paste_file_cb (GtkWidget *widget, void *data)
+{
+	sakura_paste_file_dialog();
+}
+
+
+/* Parameters are never used */
+static void
+sakura_open_log_cb (GtkWidget *widget, void *data)
+{
+	sakura_open_log_dialog();
+}
+
+
 static void
 sakura_new_tab_cb (GtkWidget *widget, void *data)
 {
@@ -1885,7 +2661,38 @@ sakura_disable_numbered_tabswitch_cb (GtkWidget *widget, void *data)
 }
 
 
-#if 0
+/* Allow or forbid OSC 52 clipboard writes in the current tab */
+static void
+sakura_osc52_cb (GtkWidget *widget, void *data)
+{
+	gint page;
+	struct sakura_tab *sk_tab;
+
+	page = gtk_notebook_get_current_page(GTK_NOTEBOOK(sakura.notebook));
+	sk_tab = sakura_get_sktab(sakura, page);
+
+	sk_tab->osc52 = gtk_check_menu_item_get_active(GTK_CHECK_MENU_ITEM(widget));
+}
+
+
+/* Start or stop recording the current tab */
+static void
+sakura_record_cb (GtkWidget *widget, void *data)
+{
+	gint page;
+	struct sakura_tab *sk_tab;
+
+	page = gtk_notebook_get_current_page(GTK_NOTEBOOK(sakura.notebook));
+	sk_tab = sakura_get_sktab(sakura, page);
+
+	if (gtk_check_menu_item_get_active(GTK_CHECK_MENU_ITEM(widget))) {
+		sakura_record_start(sk_tab);
+	} else {
+		sakura_record_stop(sk_tab);
+	}
+}
+
+
 static void
 sakura_use_fading_cb (GtkWidget *widget, void *data)
 {
@@ -1895,55 +2702,83 @@ sakura_use_fading_cb (GtkWidget *widget, void *data)
 	} else {
 		sakura.use_fading = false;
 		sakura_set_config_boolean("use_fading", FALSE);
+		sakura_set_faded(false);
 	}
 }
-#endif
 
 
 /**************************/
 /******* Functions ********/
 /**************************/
 
+/* Load the config file. This is done before gtk initialization, because some
+ * options (accessibility for the throughput profile) must be set before */
 static void
-sakura_init()
+sakura_load_config (void)
 {
 	GError *gerror=NULL;
-	char* configdir = NULL;
-	int i;
-
-	term_data_id = g_quark_from_static_string("sakura_term");
-
-	/*** Config file initialization ***/
+	gchar *cfgtmp = NULL;
 
 	sakura.cfg = g_key_file_new();
 	sakura.config_modified=false;
 
-	configdir = g_build_filename( g_get_user_config_dir(), "sakura", NULL);
-	if (!g_file_test(g_get_user_config_dir(), G_FILE_TEST_EXISTS))
-		g_mkdir(g_get_user_config_dir(), 0755 );
-	if (!g_file_test(configdir, G_FILE_TEST_EXISTS))
-		g_mkdir( configdir, 0755);
-	if (option_config_file) { /* Don't force the config path for user conf file */
-		sakura.configfile = option_config_file;
-	} else {
-		sakura.configfile = g_build_filename(configdir, DEFAULT_CONFIGFILE, NULL);
-	}
-	g_free(configdir);
+	sakura.configfile = sakura_config_path(option_config_file);
 
 	/* Open config file */
-	if (!g_key_file_load_from_file(sakura.cfg, sakura.configfile, 0, &gerror)) {
-		/* If there's no file, ignore the error. A new one is created */
-		if (gerror->code==G_KEY_FILE_ERROR_UNKNOWN_ENCODING || gerror->code==G_KEY_FILE_ERROR_INVALID_VALUE) {
-			g_error_free(gerror);
-			fprintf(stderr, "Not valid config file format\n");
+	if (!sakura_config_load(sakura.cfg, sakura.configfile, &gerror)) {
+		g_error_free(gerror);
+		fprintf(stderr, "Not valid config file format\n");
+		exit(EXIT_FAILURE);
+	}
+
+	/* Performance profile. With the command line option and -x or -e, only the tabs
+	 * executing the command use the profile; otherwise it's used by the whole window */
+	if (!g_key_file_has_key(sakura.cfg, cfg_group, "profile", NULL)) {
+		sakura_set_config_string("profile", PROFILE_DEFAULT);
+	}
+	cfgtmp = g_key_file_get_value(sakura.cfg, cfg_group, "profile", NULL);
+	sakura.throughput = (strcmp(cfgtmp, PROFILE_THROUGHPUT)==0);
+	g_free(cfgtmp);
+
+	if (option_profile) {
+		if (strcmp(option_profile, PROFILE_THROUGHPUT) != 0 && strcmp(option_profile, PROFILE_DEFAULT) != 0) {
+			fprintf(stderr, _("Unknown profile %s\n"), option_profile);
 			exit(EXIT_FAILURE);
 		}
+		if (option_execute || option_xterm_execute) {
+			sakura.command_profile = true;
+			sakura.command_throughput = (strcmp(option_profile, PROFILE_THROUGHPUT)==0);
+		} else {
+			sakura.throughput = (strcmp(option_profile, PROFILE_THROUGHPUT)==0);
+		}
+	}
+}
+
+
+static void
+sakura_init()
+{
+	GError *gerror=NULL;
+	int i;
+
+	term_data_id = g_quark_from_static_string("sakura_term");
+
+	/* Only in config file */
+	if (!g_key_file_has_key(sakura.cfg, cfg_group, "low_power", NULL)) {
+		sakura_set_config_boolean("low_power", FALSE);
+	}
+	sakura.low_power = g_key_file_get_boolean(sakura.cfg, cfg_group, "low_power", NULL);
+
+	/* Add GFile monitor to control file external changes. In low power mode we don't
+	 * watch the file, its modification time is checked when saving the config instead */
+	if (!sakura.low_power) {
+		GFile *cfgfile = g_file_new_for_path(sakura.configfile);
+		GFileMonitor *mon_cfgfile = g_file_monitor_file (cfgfile, 0, NULL, NULL);
+		g_signal_connect(G_OBJECT(mon_cfgfile), "changed", G_CALLBACK(sakura_conf_changed_cb), NULL);
 	}
 
-	/* Add GFile monitor to control file external changes */
-	GFile *cfgfile = g_file_new_for_path(sakura.configfile);
-	GFileMonitor *mon_cfgfile = g_file_monitor_file (cfgfile, 0, NULL, NULL);
-	g_signal_connect(G_OBJECT(mon_cfgfile), "changed", G_CALLBACK(sakura_conf_changed_cb), NULL);
+	GStatBuf cfgstat;
+	sakura.config_mtime = (g_stat(sakura.configfile, &cfgstat) == 0) ? cfgstat.st_mtime : 0;
 
 	gchar *cfgtmp = NULL;
 
@@ -2069,9 +2904,51 @@ sakura_init()
 	}
 	sakura.less_questions = g_key_file_get_boolean(sakura.cfg, cfg_group, "less_questions", NULL);
 
-        if (!g_key_file_has_key(sakura.cfg, cfg_group, "copy_on_select", NULL)) {
-                sakura_set_config_boolean("copy_on_select", FALSE);
-        }
+	if (!g_key_file_has_key(sakura.cfg, cfg_group, "hyperlinks", NULL)) {
+		sakura_set_config_boolean("hyperlinks", TRUE);
+	}
+	sakura.hyperlinks = g_key_file_get_boolean(sakura.cfg, cfg_group, "hyperlinks", NULL);
+
+	if (!g_key_file_has_key(sakura.cfg, cfg_group, "hyperlink_max_length", NULL)) {
+		sakura_set_config_integer("hyperlink_max_length", DEFAULT_HYPERLINK_MAX_LENGTH);
+	}
+	sakura.hyperlink_max_length = g_key_file_get_integer(sakura.cfg, cfg_group, "hyperlink_max_length", NULL);
+	sakura.hyperlink_max_length = CLAMP(sakura.hyperlink_max_length, 0, HYPERLINK_MAX_LENGTH_LIMIT);
+
+	if (!g_key_file_has_key(sakura.cfg, cfg_group, "osc52", NULL)) {
+		sakura_set_config_boolean("osc52", FALSE);
+	}
+	sakura.osc52 = g_key_file_get_boolean(sakura.cfg, cfg_group, "osc52", NULL);
+
+	if (!g_key_file_has_key(sakura.cfg, cfg_group, "osc52_max_size", NULL)) {
+		sakura_set_config_integer("osc52_max_size", DEFAULT_OSC52_MAX_SIZE);
+	}
+	sakura.osc52_max_size = g_key_file_get_integer(sakura.cfg, cfg_group, "osc52_max_size", NULL);
+	sakura.osc52_max_size = MAX(sakura.osc52_max_size, 0);
+
+	if (!g_key_file_has_key(sakura.cfg, cfg_group, "tail_lines", NULL)) {
+		sakura_set_config_integer("tail_lines", DEFAULT_TAIL_LINES);
+	}
+	sakura.tail_lines = g_key_file_get_integer(sakura.cfg, cfg_group, "tail_lines", NULL);
+
+	if (!g_key_file_has_key(sakura.cfg, cfg_group, "recording", NULL)) {
+		sakura_set_config_boolean("recording", FALSE);
+	}
+	sakura.recording = g_key_file_get_boolean(sakura.cfg, cfg_group, "recording", NULL);
+
+	if (!g_key_file_has_key(sakura.cfg, cfg_group, "recording_gzip", NULL)) {
+		sakura_set_config_boolean("recording_gzip", FALSE);
+	}
+	sakura.recording_gzip = g_key_file_get_boolean(sakura.cfg, cfg_group, "recording_gzip", NULL);
+
+	if (!g_key_file_has_key(sakura.cfg, cfg_group, "watchdog", NULL)) {
+		sakura_set_config_integer("watchdog", 0);
+	}
+	sakura.watchdog_threshold = g_key_file_get_integer(sakura.cfg, cfg_group, "watchdog", NULL);
+
+        if (!g_key_file_has_key(sakura.cfg, cfg_group, "copy_on_select", NULL)) {
+                sakura_set_config_boolean("copy_on_select", FALSE);
+        }
         sakura.copy_on_select = g_key_file_get_boolean(sakura.cfg, cfg_group, "copy_on_select", NULL);
 
 	if (!g_key_file_has_key(sakura.cfg, cfg_group, "disable_numbered_tabswitch", NULL)) {
@@ -2170,6 +3047,22 @@ sakura_init()
 	}
 	sakura.open_url_accelerator = g_key_file_get_integer(sakura.cfg, cfg_group, "open_url_accelerator", NULL);
 
+	if (!g_key_file_has_key(sakura.cfg, cfg_group, "link_detection", NULL)) {
+		sakura_set_config_string("link_detection", "hover");
+	}
+	cfgtmp = g_key_file_get_value(sakura.cfg, cfg_group, "link_detection", NULL);
+	if (strcmp(cfgtmp, "hover")==0) {
+		sakura.link_detection = LINK_DETECTION_HOVER;
+	} else if (strcmp(cfgtmp, "modifier")==0) {
+		sakura.link_detection = LINK_DETECTION_MODIFIER;
+	} else if (strcmp(cfgtmp, "off")==0) {
+		sakura.link_detection = LINK_DETECTION_OFF;
+	} else {
+		fprintf(stderr, "Invalid configuration value: link_detection=%s (valid values: hover|modifier|off)\n", cfgtmp);
+		sakura.link_detection = LINK_DETECTION_HOVER;
+	}
+	g_free(cfgtmp);
+
 	if (!g_key_file_has_key(sakura.cfg, cfg_group, "font_size_accelerator", NULL)) {
 		sakura_set_config_integer("font_size_accelerator", DEFAULT_FONT_SIZE_ACCELERATOR);
 	}
@@ -2220,6 +3113,11 @@ sakura_init()
 	}
 	sakura.paste_key = sakura_get_keybind("paste_key");
 
+	if (!g_key_file_has_key(sakura.cfg, cfg_group, "paste_file_key", NULL)) {
+		sakura_set_keybind("paste_file_key", DEFAULT_PASTE_FILE_KEY);
+	}
+	sakura.paste_file_key = sakura_get_keybind("paste_file_key");
+
 	if (!g_key_file_has_key(sakura.cfg, cfg_group, "scrollbar_key", NULL)) {
 		sakura_set_keybind("scrollbar_key", DEFAULT_SCROLLBAR_KEY);
 	}
@@ -2307,38 +3205,25 @@ sakura_init()
 	gtk_window_set_title(GTK_WINDOW(sakura.main_window), "sakura");
 	gtk_widget_set_name(sakura.main_window, "sakura");
 
-	sakura.fade_window = gtk_window_new(GTK_WINDOW_POPUP);
-	gtk_widget_set_name(sakura.fade_window, "fade_window");
-	gtk_window_set_position(GTK_WINDOW(sakura.fade_window), GTK_WIN_POS_NONE);
-	gtk_widget_set_opacity(sakura.fade_window, FADE_WINDOW_OPACITY);
-	gtk_window_set_transient_for(GTK_WINDOW(sakura.fade_window), GTK_WINDOW(sakura.main_window));
-
-	/* Add CSS styles for main and fade window*/
+	/* Add CSS styles for main window */
 	GtkCssProvider *provider = gtk_css_provider_new();
 	GdkScreen *screen = gtk_widget_get_screen(GTK_WIDGET(sakura.main_window));
 	gtk_css_provider_load_from_data(provider, SAKURA_CSS, -1, NULL);
 	gtk_style_context_add_provider_for_screen(screen, GTK_STYLE_PROVIDER (provider), GTK_STYLE_PROVIDER_PRIORITY_APPLICATION);
 	g_object_unref(provider);
 
-	provider = gtk_css_provider_new();
-	screen = gtk_widget_get_screen(GTK_WIDGET(sakura.fade_window));
-	gtk_css_provider_load_from_data(provider, FADE_WINDOW_CSS, -1, NULL);
-	gtk_style_context_add_provider_for_screen(screen, GTK_STYLE_PROVIDER (provider), GTK_STYLE_PROVIDER_PRIORITY_APPLICATION);
-	g_object_unref(provider);
-
 	/* Create notebook and set style */
 	sakura.notebook = gtk_notebook_new();
 	gtk_notebook_set_scrollable((GtkNotebook*)sakura.notebook, sakura.scrollable_tabs);
 
 	/* Adding mask, for handle scroll events */
 	gtk_widget_add_events(sakura.notebook, GDK_SCROLL_MASK);
+
+	/* We want to know when the main window is fully obscured */
+	gtk_widget_add_events(sakura.main_window, GDK_VISIBILITY_NOTIFY_MASK);
 	
-	/* Figure out if we have rgba capabilities. Without this transparency won't work as expected */
-	screen = gtk_widget_get_screen (GTK_WIDGET (sakura.main_window));
-	GdkVisual *visual = gdk_screen_get_rgba_visual (screen);
-	if (visual != NULL && gdk_screen_is_composited (screen)) {
-		gtk_widget_set_visual (GTK_WIDGET (sakura.main_window), visual);
-	}
+	/* Use the rgba visual only if some colorset is transparent. Opaque windows don't need alpha blending */
+	sakura_set_visual(sakura_uses_transparency());
 	
 	/*** Command line options initialization ***/
 
@@ -2368,6 +3253,7 @@ sakura_init()
 	gtk_window_set_icon_from_file(GTK_WINDOW(sakura.main_window), icon_path, &gerror);
 	g_free(icon_path); icon_path=NULL;
 	if (gerror) g_error_free(gerror);
+	sakura_startup_trace(STARTUP_ICON);
 
 	/* More options */
 	if (option_title) {
@@ -2401,20 +3287,53 @@ sakura_init()
 	sakura.resized = FALSE;
 	sakura.externally_modified = false;
 	sakura.first_run=true;
+	sakura.iconified = sakura.obscured = sakura.suspended = false;
+	sakura.has_focus = false;
+
+	/* Wakeup statistics. Our poll function counts who woke us up, and we report it every second */
+	if (option_wakeup_stats) {
+		sakura.wakeups = g_hash_table_new(g_direct_hash, g_direct_equal);
+		sakura.wakeups_total = 0;
+		sakura.default_poll = g_main_context_get_poll_func(NULL);
+		g_main_context_set_poll_func(NULL, sakura_wakeup_poll);
+	}
+
+	/* Only add the housekeeping timer if there's some periodic work to do */
+	if (option_wakeup_stats) {
+		sakura.housekeeping_id = g_timeout_add_seconds(HOUSEKEEPING_INTERVAL, sakura_housekeeping_cb, NULL);
+		g_source_set_name_by_id(sakura.housekeeping_id, "sakura housekeeping");
+	}
 
 	gerror = NULL;
-	sakura.http_vteregexp = vte_regex_new_for_match(HTTP_REGEXP, strlen(HTTP_REGEXP), PCRE2_MULTILINE, &gerror);
+	sakura.http_vteregexp = sakura_new_jit_regex(HTTP_REGEXP, &gerror);
 	if (!sakura.http_vteregexp) {
-		SAY("http_regexp: %s", gerror->message);
+		WARN("http_regexp: %s", gerror->message);
 		g_error_free(gerror);
 	}
 	gerror=NULL;
-	sakura.mail_vteregexp = vte_regex_new_for_match(MAIL_REGEXP, strlen(MAIL_REGEXP), PCRE2_MULTILINE, &gerror);
+	sakura.mail_vteregexp = sakura_new_jit_regex(MAIL_REGEXP, &gerror);
 	if (!sakura.mail_vteregexp) {
-		SAY("mail_regexp: %s", gerror->message);
+		WARN("mail_regexp: %s", gerror->message);
 		g_error_free(gerror);
 	}
 
+	sakura_load_matchers();
+	sakura_startup_trace(STARTUP_REGEX);
+
+	if (option_startup_trace) {
+		g_signal_connect(G_OBJECT(sakura.main_window), "map-event", G_CALLBACK(sakura_startup_map_cb), NULL);
+	}
+
+	/* kill -USR1 prints the memory used by the tabs and the callback statistics, and dumps the trace ring */
+	g_unix_signal_add(SIGUSR1, sakura_dump_cb, NULL);
+
+	if (sakura.watchdog_threshold > 0) {
+		sakura_watchdog_start(sakura.watchdog_threshold);
+	}
+
+	sakura.search_cache = g_queue_new();
+	sakura.search_history = g_queue_new();
+
 	gtk_container_add(GTK_CONTAINER(sakura.main_window), sakura.notebook);
 
 	sakura_init_popup();
@@ -2422,10 +3341,13 @@ sakura_init()
 	g_signal_connect(G_OBJECT(sakura.main_window), "delete_event", G_CALLBACK(sakura_delete_event_cb), NULL);
 	g_signal_connect(G_OBJECT(sakura.main_window), "destroy", G_CALLBACK(sakura_destroy_window_cb), NULL);
 	g_signal_connect(G_OBJECT(sakura.main_window), "key-press-event", G_CALLBACK(sakura_key_press_cb), NULL);
+	g_signal_connect(G_OBJECT(sakura.main_window), "key-release-event", G_CALLBACK(sakura_key_release_cb), NULL);
 	g_signal_connect(G_OBJECT(sakura.main_window), "configure-event", G_CALLBACK(sakura_resized_window_cb), NULL);
 	g_signal_connect(G_OBJECT(sakura.main_window), "focus-out-event", G_CALLBACK(sakura_focus_out_cb), NULL);
 	g_signal_connect(G_OBJECT(sakura.main_window), "focus-in-event", G_CALLBACK(sakura_focus_in_cb), NULL);
 	g_signal_connect(G_OBJECT(sakura.main_window), "show", G_CALLBACK(sakura_show_event_cb), NULL);
+	g_signal_connect(G_OBJECT(sakura.main_window), "window-state-event", G_CALLBACK(sakura_window_state_cb), NULL);
+	g_signal_connect(G_OBJECT(sakura.main_window), "visibility-notify-event", G_CALLBACK(sakura_visibility_cb), NULL);
 }
 
 
@@ -2433,25 +3355,29 @@ static void
 sakura_init_popup()
 {
 	GtkWidget *item_new_tab, *item_set_name, *item_close_tab, *item_copy,
-	          *item_paste, *item_fullscreen, *item_select_font, *item_select_colors,
+	          *item_paste, *item_paste_file, *item_open_log, *item_fullscreen, *item_select_font, *item_select_colors,
 	          *item_show_tab_bar,
 	          *item_show_tab_bar_always, *item_show_tab_bar_multiple, *item_show_tab_bar_never,
 	          *item_toggle_scrollbar, *item_options,
 	          *item_urgent_bell, *item_audible_bell, *item_blinking_cursor,
 	          *item_cursor, *item_cursor_block, *item_cursor_underline, *item_cursor_ibeam,
 		  *item_tabs_on_bottom, *item_less_questions, *item_copy_on_select,
-	          *item_disable_numbered_tabswitch, *item_new_tab_after_current; // *item_use_fading;
+	          *item_disable_numbered_tabswitch, *item_new_tab_after_current, *item_use_fading;
 	GtkWidget *options_menu, *show_tab_bar_menu, *cursor_menu;
 
 	sakura.item_open_mail = gtk_menu_item_new_with_label(_("Open mail"));
 	sakura.item_open_link = gtk_menu_item_new_with_label(_("Open link"));
 	sakura.item_copy_link = gtk_menu_item_new_with_label(_("Copy link"));
+	sakura.item_osc52 = gtk_check_menu_item_new_with_label(_("Allow clipboard writes"));
+	sakura.item_record = gtk_check_menu_item_new_with_label(_("Record"));
 	item_new_tab = gtk_menu_item_new_with_label(_("New tab"));
+	item_open_log = gtk_menu_item_new_with_label(_("Open log..."));
 	item_set_name = gtk_menu_item_new_with_label(_("Set tab name..."));
 	item_close_tab = gtk_menu_item_new_with_label(_("Close tab"));
 	item_fullscreen = gtk_menu_item_new_with_label(_("Full screen"));
 	item_copy = gtk_menu_item_new_with_label(_("Copy"));
 	item_paste = gtk_menu_item_new_with_label(_("Paste"));
+	item_paste_file = gtk_menu_item_new_with_label(_("Paste file..."));
 
 	item_options = gtk_menu_item_new_with_label(_("Options"));
 
@@ -2472,7 +3398,7 @@ sakura_init_popup()
 	item_audible_bell = gtk_check_menu_item_new_with_label(_("Set audible bell"));
 	item_blinking_cursor = gtk_check_menu_item_new_with_label(_("Set blinking cursor"));
 	item_disable_numbered_tabswitch = gtk_check_menu_item_new_with_label(_("Disable numbered tabswitch"));
-	//item_use_fading = gtk_check_menu_item_new_with_label(_("Enable focus fade"));
+	item_use_fading = gtk_check_menu_item_new_with_label(_("Enable focus fade"));
 	item_cursor = gtk_menu_item_new_with_label(_("Set cursor type"));
 	item_cursor_block = gtk_radio_menu_item_new_with_label(NULL, _("Block"));
 	item_cursor_underline = gtk_radio_menu_item_new_with_label_from_widget(GTK_RADIO_MENU_ITEM(item_cursor_block), _("Underline"));
@@ -2524,11 +3450,11 @@ sakura_init_popup()
 		gtk_check_menu_item_set_active(GTK_CHECK_MENU_ITEM(item_disable_numbered_tabswitch), FALSE);
 	}
 
-	//if (sakura.use_fading) {
-	//	gtk_check_menu_item_set_active(GTK_CHECK_MENU_ITEM(item_use_fading), TRUE);
-	//} else {
-	//	gtk_check_menu_item_set_active(GTK_CHECK_MENU_ITEM(item_use_fading), FALSE);
-	//}
+	if (sakura.use_fading) {
+		gtk_check_menu_item_set_active(GTK_CHECK_MENU_ITEM(item_use_fading), TRUE);
+	} else {
+		gtk_check_menu_item_set_active(GTK_CHECK_MENU_ITEM(item_use_fading), FALSE);
+	}
 
 	if (sakura.urgent_bell) {
 		gtk_check_menu_item_set_active(GTK_CHECK_MENU_ITEM(item_urgent_bell), TRUE);
@@ -2563,13 +3489,17 @@ sakura_init_popup()
 	gtk_menu_shell_append(GTK_MENU_SHELL(sakura.menu), sakura.item_copy_link);
 	gtk_menu_shell_append(GTK_MENU_SHELL(sakura.menu), sakura.open_link_separator);
 	gtk_menu_shell_append(GTK_MENU_SHELL(sakura.menu), item_new_tab);
+	gtk_menu_shell_append(GTK_MENU_SHELL(sakura.menu), item_open_log);
 	gtk_menu_shell_append(GTK_MENU_SHELL(sakura.menu), item_set_name);
 	gtk_menu_shell_append(GTK_MENU_SHELL(sakura.menu), item_close_tab);
+	gtk_menu_shell_append(GTK_MENU_SHELL(sakura.menu), sakura.item_osc52);
+	gtk_menu_shell_append(GTK_MENU_SHELL(sakura.menu), sakura.item_record);
 	gtk_menu_shell_append(GTK_MENU_SHELL(sakura.menu), gtk_separator_menu_item_new());
 	gtk_menu_shell_append(GTK_MENU_SHELL(sakura.menu), item_fullscreen);
 	gtk_menu_shell_append(GTK_MENU_SHELL(sakura.menu), gtk_separator_menu_item_new());
 	gtk_menu_shell_append(GTK_MENU_SHELL(sakura.menu), item_copy);
 	gtk_menu_shell_append(GTK_MENU_SHELL(sakura.menu), item_paste);
+	gtk_menu_shell_append(GTK_MENU_SHELL(sakura.menu), item_paste_file);
 	gtk_menu_shell_append(GTK_MENU_SHELL(sakura.menu), gtk_separator_menu_item_new());
 	gtk_menu_shell_append(GTK_MENU_SHELL(sakura.menu), item_options);
 
@@ -2593,7 +3523,7 @@ sakura_init_popup()
 	gtk_menu_shell_append(GTK_MENU_SHELL(options_menu), item_urgent_bell);
 	gtk_menu_shell_append(GTK_MENU_SHELL(options_menu), item_audible_bell);
 	gtk_menu_shell_append(GTK_MENU_SHELL(options_menu), item_disable_numbered_tabswitch);
-	//gtk_menu_shell_append(GTK_MENU_SHELL(options_menu), item_use_fading);
+	gtk_menu_shell_append(GTK_MENU_SHELL(options_menu), item_use_fading);
 	gtk_menu_shell_append(GTK_MENU_SHELL(options_menu), item_blinking_cursor);
 	gtk_menu_shell_append(GTK_MENU_SHELL(options_menu), item_cursor);
 	gtk_menu_shell_append(GTK_MENU_SHELL(cursor_menu), item_cursor_block);
@@ -2611,6 +3541,8 @@ sakura_init_popup()
 	g_signal_connect(G_OBJECT(item_select_font), "activate", G_CALLBACK(sakura_font_dialog_cb), NULL);
 	g_signal_connect(G_OBJECT(item_copy), "activate", G_CALLBACK(sakura_copy_cb), NULL);
 	g_signal_connect(G_OBJECT(item_paste), "activate", G_CALLBACK(sakura_paste_cb), NULL);
+	g_signal_connect(G_OBJECT(item_paste_file), "activate", G_CALLBACK(sakura_paste_file_cb), NULL);
+	g_signal_connect(G_OBJECT(item_open_log), "activate", G_CALLBACK(sakura_open_log_cb), NULL);
 	g_signal_connect(G_OBJECT(item_select_colors), "activate", G_CALLBACK(sakura_color_dialog_cb), NULL);
 
 	g_signal_connect(G_OBJECT(item_show_tab_bar_always), "activate", G_CALLBACK(sakura_show_tab_bar_cb), "always");
@@ -2625,7 +3557,7 @@ sakura_init_popup()
 	g_signal_connect(G_OBJECT(item_audible_bell), "activate", G_CALLBACK(sakura_audible_bell_cb), NULL);
 	g_signal_connect(G_OBJECT(item_blinking_cursor), "activate", G_CALLBACK(sakura_blinking_cursor_cb), NULL);
 	g_signal_connect(G_OBJECT(item_disable_numbered_tabswitch), "activate", G_CALLBACK(sakura_disable_numbered_tabswitch_cb), NULL);
-	//g_signal_connect(G_OBJECT(item_use_fading), "activate", G_CALLBACK(sakura_use_fading_cb), NULL);
+	g_signal_connect(G_OBJECT(item_use_fading), "activate", G_CALLBACK(sakura_use_fading_cb), NULL);
 	g_signal_connect(G_OBJECT(item_cursor_block), "activate", G_CALLBACK(sakura_set_cursor_cb), "block");
 	g_signal_connect(G_OBJECT(item_cursor_underline), "activate", G_CALLBACK(sakura_set_cursor_cb), "underline");
 	g_signal_connect(G_OBJECT(item_cursor_ibeam), "activate", G_CALLBACK(sakura_set_cursor_cb), "ibeam");
@@ -2633,6 +3565,8 @@ sakura_init_popup()
 	g_signal_connect(G_OBJECT(sakura.item_open_mail), "activate", G_CALLBACK(sakura_open_mail_cb), NULL);
 	g_signal_connect(G_OBJECT(sakura.item_open_link), "activate", G_CALLBACK(sakura_open_url_cb), NULL);
 	g_signal_connect(G_OBJECT(sakura.item_copy_link), "activate", G_CALLBACK(sakura_copy_url_cb), NULL);
+	g_signal_connect(G_OBJECT(sakura.item_osc52), "activate", G_CALLBACK(sakura_osc52_cb), NULL);
+	g_signal_connect(G_OBJECT(sakura.item_record), "activate", G_CALLBACK(sakura_record_cb), NULL);
 	g_signal_connect(G_OBJECT(item_fullscreen), "activate", G_CALLBACK(sakura_fullscreen_cb), NULL);
 
 	gtk_widget_show_all(sakura.menu);
@@ -2661,9 +3595,10 @@ static void
 sakura_search_dialog ()
 {
 	GtkWidget *title_dialog, *title_header;
-	GtkWidget *entry, *label;
+	GtkWidget *combo, *entry, *label;
 	GtkWidget *title_hbox;
 	gint response;
+	GList *item;
 
 	title_dialog=gtk_dialog_new_with_buttons(_("Search"),
 	                                         GTK_WINDOW(sakura.main_window),
@@ -2677,12 +3612,17 @@ sakura_search_dialog ()
 	gtk_header_bar_set_show_close_button(GTK_HEADER_BAR(title_header), FALSE);
 	gtk_dialog_set_default_response(GTK_DIALOG(title_dialog), GTK_RESPONSE_ACCEPT);
 
-	entry = gtk_entry_new();
+	/* Previous searches are available in the combo box */
+	combo = gtk_combo_box_text_new_with_entry();
+	for (item = g_queue_peek_head_link(sakura.search_history); item; item = item->next) {
+		gtk_combo_box_text_append_text(GTK_COMBO_BOX_TEXT(combo), item->data);
+	}
+	entry = gtk_bin_get_child(GTK_BIN(combo));
 	label = gtk_label_new(_("Search"));
 	title_hbox = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 0);
 	gtk_entry_set_activates_default(GTK_ENTRY(entry), TRUE);
 	gtk_box_pack_start(GTK_BOX(title_hbox), label, TRUE, TRUE, 12);
-	gtk_box_pack_start(GTK_BOX(title_hbox), entry, TRUE, TRUE, 12);
+	gtk_box_pack_start(GTK_BOX(title_hbox), combo, TRUE, TRUE, 12);
 	gtk_box_pack_start(GTK_BOX(gtk_dialog_get_content_area(GTK_DIALOG(title_dialog))), title_hbox, FALSE, FALSE, 12);
 
 	/* Disable accept button until some text is entered */
@@ -2693,6 +3633,7 @@ sakura_search_dialog ()
 
 	response = gtk_dialog_run(GTK_DIALOG(title_dialog));
 	if (response == GTK_RESPONSE_ACCEPT) {
+		sakura_add_search_history(gtk_entry_get_text(GTK_ENTRY(entry)));
 		sakura_search(gtk_entry_get_text(GTK_ENTRY(entry)), 0);
 	}
 	gtk_widget_destroy(title_dialog);
@@ -2712,7 +3653,7 @@ sakura_search (const char *pattern, bool reverse)
 
 	vte_terminal_search_set_wrap_around(VTE_TERMINAL(sk_tab->vte), TRUE);
 
-	regex=vte_regex_new_for_search(pattern, (gssize) strlen(pattern), PCRE2_MULTILINE|PCRE2_CASELESS, &error);
+	regex=sakura_get_search_regex(pattern, PCRE2_MULTILINE|PCRE2_CASELESS, &error);
 	if (!regex) { /* Ubuntu-fucking-morons (17.10/18.04/18.10) package a broken VTE without PCRE2, and search fails */
 		      /* For more info about their moronity please look at https://github.com/gnunn1/tilix/issues/916   */
 		sakura_error(error->message);
@@ -2724,42 +3665,79 @@ sakura_search (const char *pattern, bool reverse)
 			vte_terminal_unselect_all(VTE_TERMINAL(sk_tab->vte));
 			vte_terminal_search_find_next(VTE_TERMINAL(sk_tab->vte));
 		}
-
-		if (regex) vte_regex_unref(regex);
 	}
 }
 
 
-static void
-sakura_copy ()
+/* Get a compiled search regex from the cache, or compile it and add it to the cache. The
+ * cache keeps the reference, the caller must not unref the regex */
+static VteRegex *
+sakura_get_search_regex (const char *pattern, guint32 flags, GError **error)
 {
-	gint page;
-	struct sakura_tab *sk_tab;
+	struct sakura_search_regex *cached;
+	VteRegex *regex;
+	GList *item;
+
+	for (item = g_queue_peek_head_link(sakura.search_cache); item; item = item->next) {
+		cached = item->data;
+		if (cached->flags == flags && strcmp(cached->pattern, pattern) == 0) {
+			/* Most recently used goes first */
+			g_queue_unlink(sakura.search_cache, item);
+			g_queue_push_head_link(sakura.search_cache, item);
+			return cached->regex;
+		}
+	}
 
-	page = gtk_notebook_get_current_page(GTK_NOTEBOOK(sakura.notebook));
-	sk_tab = sakura_get_sktab(sakura, page);
+	cached = g_new0(struct sakura_search_regex, 1);
+	cached->regex = vte_regex_new_for_search(pattern, (gssize) strlen(pattern), flags, error);
+	if (!cached->regex) {
+		g_free(cached);
+		return NULL;
+	}
 
-	if (vte_terminal_get_has_selection(VTE_TERMINAL(sk_tab->vte))) {
-		vte_terminal_copy_clipboard_format(VTE_TERMINAL(sk_tab->vte), VTE_FORMAT_TEXT);
+	/* The regex is matched against every row of the scrollback, and it's cached, so the JIT
+	 * compilation is paid only once. Literal patterns too, the interpreter is much slower */
+	vte_regex_jit(cached->regex, PCRE2_JIT_COMPLETE, NULL);
+
+	cached->pattern = g_strdup(pattern);
+	cached->flags = flags;
+	g_queue_push_head(sakura.search_cache, cached);
+	regex = cached->regex;
+
+	/* Drop the least recently used regex */
+	if (g_queue_get_length(sakura.search_cache) > SEARCH_CACHE_SIZE) {
+		cached = g_queue_pop_tail(sakura.search_cache);
+		vte_regex_unref(cached->regex);
+		g_free(cached->pattern);
+		g_free(cached);
 	}
+
+	return regex;
 }
 
 
+/* Add a pattern to the search history. Repeated patterns are moved to the top */
 static void
-sakura_paste ()
+sakura_add_search_history (const char *pattern)
 {
-	gint page;
-	struct sakura_tab *sk_tab;
+	GList *item;
 
-	page = gtk_notebook_get_current_page(GTK_NOTEBOOK(sakura.notebook));
-	sk_tab = sakura_get_sktab(sakura, page);
+	item = g_queue_find_custom(sakura.search_history, pattern, (GCompareFunc) strcmp);
+	if (item) {
+		g_free(item->data);
+		g_queue_delete_link(sakura.search_history, item);
+	}
 
-	vte_terminal_paste_clipboard(VTE_TERMINAL(sk_tab->vte));
+	g_queue_push_head(sakura.search_history, g_strdup(pattern));
+
+	if (g_queue_get_length(sakura.search_history) > SEARCH_HISTORY_SIZE) {
+		g_free(g_queue_pop_tail(sakura.search_history));
+	}
 }
 
 
 static void
-sakura_paste_primary ()
+sakura_copy ()
 {
 	gint page;
 	struct sakura_tab *sk_tab;
@@ -2767,272 +3745,3213 @@ sakura_paste_primary ()
 	page = gtk_notebook_get_current_page(GTK_NOTEBOOK(sakura.notebook));
 	sk_tab = sakura_get_sktab(sakura, page);
 
-	vte_terminal_paste_primary(VTE_TERMINAL(sk_tab->vte));
+	if (vte_terminal_get_has_selection(VTE_TERMINAL(sk_tab->vte))) {
+		vte_terminal_copy_clipboard_format(VTE_TERMINAL(sk_tab->vte), VTE_FORMAT_TEXT);
+	}
 }
 
 
+/* Claim the CLIPBOARD for the selection, without getting the text from vte until somebody
+ * asks for it. Selections that haven't changed since the last claim are not claimed again */
 static void
-sakura_show_scrollbar (void)
+sakura_copy_on_select (struct sakura_tab *sk_tab)
 {
-	gint page, n_pages;
-	struct sakura_tab *sk_tab;
-	int i;
+#if VTE_CHECK_VERSION(0, 72, 0)
+	GtkClipboard *clipboard;
+	GtkTargetList *target_list;
+	GtkTargetEntry *targets;
+	gint n_targets;
 
-	n_pages = gtk_notebook_get_n_pages(GTK_NOTEBOOK(sakura.notebook));
-	page = gtk_notebook_get_current_page(GTK_NOTEBOOK(sakura.notebook));
-	sk_tab = sakura_get_sktab(sakura, page);
+	if (!vte_terminal_get_has_selection(VTE_TERMINAL(sk_tab->vte)))
+		return;
 
-	if (!g_key_file_get_boolean(sakura.cfg, cfg_group, "scrollbar", NULL)) {
-		sakura.show_scrollbar = true;
-		sakura_set_config_boolean("scrollbar", TRUE);
-	} else {
-		sakura.show_scrollbar = false;
-		sakura_set_config_boolean("scrollbar", FALSE);
+	if (sk_tab->vte == sakura.clipboard_vte && !sakura.clipboard_stale)
+		return;
+
+	target_list = gtk_target_list_new(NULL, 0);
+	gtk_target_list_add_text_targets(target_list, 0);
+	targets = gtk_target_table_new_from_list(target_list, &n_targets);
+
+	clipboard = gtk_widget_get_clipboard(sk_tab->vte, GDK_SELECTION_CLIPBOARD);
+	if (gtk_clipboard_set_with_owner(clipboard, targets, n_targets, sakura_clipboard_get_cb,
+	                                 sakura_clipboard_clear_cb, G_OBJECT(sk_tab->vte))) {
+		/* Setting it again clears the previous owner, so this goes after the call */
+		g_free(sakura.clipboard_text);
+		sakura.clipboard_text = NULL;
+		sakura.clipboard_vte = sk_tab->vte;
+		sakura.clipboard_stale = false;
+		sakura_clipboard_watch(sk_tab);
 	}
 
-	/* Toggle/Untoggle the scrollbar for all tabs */
-	for (i = (n_pages - 1); i >= 0; i--) {
-		sk_tab = sakura_get_sktab(sakura, i);
-		if (!sakura.show_scrollbar)
-			gtk_widget_hide(sk_tab->scrollbar);
-		else
-			gtk_widget_show(sk_tab->scrollbar);
+	gtk_target_table_free(targets, n_targets);
+	gtk_target_list_unref(target_list);
+#else
+	/* No way to get the selected text from vte: copy it now */
+	if (vte_terminal_get_has_selection(VTE_TERMINAL(sk_tab->vte))) {
+		vte_terminal_copy_clipboard_format(VTE_TERMINAL(sk_tab->vte), VTE_FORMAT_TEXT);
 	}
-	sakura_set_size();
+#endif
 }
 
 
+/* Get the text of the selection we are offering as CLIPBOARD, if we still don't have it */
 static void
-sakura_set_size (void)
+sakura_clipboard_fetch ()
 {
-	struct sakura_tab *sk_tab;
-	gint pad_x, pad_y;
-	gint char_width, char_height;
-	guint npages;
-	gint min_width, natural_width;
-	gint page;
-
+#if VTE_CHECK_VERSION(0, 72, 0)
+	if (!sakura.clipboard_vte || sakura.clipboard_text)
+		return;
 
-	sk_tab = sakura_get_sktab(sakura, 0);
-	npages = gtk_notebook_get_n_pages(GTK_NOTEBOOK(sakura.notebook));
+	sakura.clipboard_text = vte_terminal_get_text_selected(VTE_TERMINAL(sakura.clipboard_vte), VTE_FORMAT_TEXT);
 
-	/* Mayhaps an user resize happened. Check if row and columns have changed */
-	if (sakura.resized) {
-		sakura.columns = vte_terminal_get_column_count(VTE_TERMINAL(sk_tab->vte));
-		sakura.rows = vte_terminal_get_row_count(VTE_TERMINAL(sk_tab->vte));
-		SAY("New columns %ld and rows %ld", sakura.columns, sakura.rows);
-		sakura.resized = FALSE;
+	if (sakura.clipboard_watch_id) {
+		g_source_remove(sakura.clipboard_watch_id);
+		sakura.clipboard_watch_id = 0;
 	}
+#endif
+}
 
-	gtk_style_context_get_padding(gtk_widget_get_style_context(sk_tab->vte),
-		gtk_widget_get_state_flags(sk_tab->vte),
-		&sk_tab->padding);
-	pad_x = sk_tab->padding.left + sk_tab->padding.right;
-	pad_y = sk_tab->padding.top + sk_tab->padding.bottom;
-	//SAY("padding x %d y %d", pad_x, pad_y);
-	char_width = vte_terminal_get_char_width(VTE_TERMINAL(sk_tab->vte));
-	char_height = vte_terminal_get_char_height(VTE_TERMINAL(sk_tab->vte));
-	char_height = (int) (sakura.line_height * char_height);
-
-	sakura.width = pad_x + (char_width * sakura.columns);
-	sakura.height = pad_y + (char_height * sakura.rows);
-
-	if (sakura.show_tab_bar == SHOW_TAB_BAR_ALWAYS || (sakura.show_tab_bar == SHOW_TAB_BAR_MULTIPLE && npages > 1)) {
 
-		/* TODO: Yeah i know, this is utter shit. Remove this ugly hack and set geometry hints*/
-		if (!sakura.show_scrollbar)
-			//sakura.height += min_height - 10;
-			sakura.height += 10;
-		else
-			//sakura.height += min_height - 47;
-			sakura.height += 47;
+#if VTE_CHECK_VERSION(0, 72, 0)
+/* New output can overwrite, clear or scroll away the selection we are offering, so get
+ * its text when the child has written something, before vte reads it. High priority:
+ * vte's pty source isn't dispatched in the same main loop iteration. Feed tabs have
+ * no pty, sakura_feed_output gets the text before feeding the terminal */
+static void
+sakura_clipboard_watch (struct sakura_tab *sk_tab)
+{
+	gint fd;
 
-		sakura.width += 8;
-		sakura.width += /* (hb*2)+*/ (pad_x*2);
+	if (sakura.clipboard_watch_id) {
+		g_source_remove(sakura.clipboard_watch_id);
+		sakura.clipboard_watch_id = 0;
 	}
 
-	page = gtk_notebook_get_current_page(GTK_NOTEBOOK(sakura.notebook));
-	sk_tab = sakura_get_sktab(sakura, page);
+	if ((fd = sakura_tab_get_pty_fd(sk_tab)) < 0)
+		return;
 
-	gtk_widget_get_preferred_width(sk_tab->scrollbar, &min_width, &natural_width);
-	//SAY("SCROLLBAR min width %d natural width %d", min_width, natural_width);
-	if (sakura.show_scrollbar) {
-		sakura.width += min_width;
-	}
+	sakura.clipboard_watch_id = g_unix_fd_add_full(G_PRIORITY_HIGH, fd, G_IO_IN|G_IO_HUP|G_IO_ERR,
+	                                               sakura_clipboard_watch_cb, NULL, NULL);
+}
 
-	/* Maximize window at init time when command line option is used */
-	if (option_maximize && sakura.first_run) {
-		gtk_window_maximize(GTK_WINDOW(sakura.main_window));
-		gtk_widget_show_all(GTK_WIDGET(sakura.main_window));
-		return; /* No need to resize */
-	}
 
-	gtk_window_resize(GTK_WINDOW(sakura.main_window), sakura.width, sakura.height);
-	SAY("Resized to %d %d", sakura.width, sakura.height);
+static gboolean
+sakura_clipboard_watch_cb (gint fd, GIOCondition condition, gpointer data)
+{
+	sakura.clipboard_watch_id = 0;
+	sakura_clipboard_fetch();
+
+	return G_SOURCE_REMOVE;
 }
+#endif
 
 
 static void
-sakura_set_font()
+sakura_paste ()
 {
-	gint n_pages;
+	gint page;
 	struct sakura_tab *sk_tab;
-	int i;
 
-	n_pages=gtk_notebook_get_n_pages(GTK_NOTEBOOK(sakura.notebook));
+	page = gtk_notebook_get_current_page(GTK_NOTEBOOK(sakura.notebook));
+	sk_tab = sakura_get_sktab(sakura, page);
 
-	/* Set the font for all tabs */
-	for (i = (n_pages - 1); i >= 0; i--) {
-		sk_tab = sakura_get_sktab(sakura, i);
-		vte_terminal_set_font(VTE_TERMINAL(sk_tab->vte), sakura.font);
-		vte_terminal_set_cell_height_scale(VTE_TERMINAL(sk_tab->vte), sakura.line_height);
-	}
+	sakura_paste_selection(sk_tab, GDK_SELECTION_CLIPBOARD);
 }
 
-/* Set colorset when colosert keybinding is used */
+
 static void
-sakura_set_colorset (int cs)
+sakura_paste_primary ()
 {
 	gint page;
 	struct sakura_tab *sk_tab;
 
-	if (cs < 0 || cs >= NUM_COLORSETS)
-		return;
-
 	page = gtk_notebook_get_current_page(GTK_NOTEBOOK(sakura.notebook));
 	sk_tab = sakura_get_sktab(sakura, page);
-	sk_tab->colorset = cs;
-
-	sakura_set_config_integer("last_colorset", sk_tab->colorset+1);
 
-	sakura_set_colors();
+	sakura_paste_selection(sk_tab, GDK_SELECTION_PRIMARY);
 }
 
 
-/* Set the terminal colors for all notebook tabs */
+/* Get the selection contents without blocking, and paste them when they arrive */
 static void
-sakura_set_colors ()
+sakura_paste_selection (struct sakura_tab *sk_tab, GdkAtom selection)
 {
-	int i;
-	int n_pages = gtk_notebook_get_n_pages(GTK_NOTEBOOK(sakura.notebook));
-	struct sakura_tab *sk_tab;
+#if VTE_CHECK_VERSION(0, 68, 0)
+	GtkClipboard *clipboard;
 
-	for (i = (n_pages - 1); i >= 0; i--) {
-		sk_tab = sakura_get_sktab(sakura, i);
+	if (!sakura_paste_takes_input(sk_tab)) {
+		sakura_error("This tab doesn't take input");
+		return;
+	}
 
-		/* Set fore, back, cursor color and palette for the terminal's colorset */
-		vte_terminal_set_colors(VTE_TERMINAL(sk_tab->vte),
-		                        &sakura.forecolors[sk_tab->colorset],
-		                        &sakura.backcolors[sk_tab->colorset],
-		                        sakura.palette, PALETTE_SIZE);
-		vte_terminal_set_color_cursor(VTE_TERMINAL(sk_tab->vte), &sakura.curscolors[sk_tab->colorset]);
+	clipboard = gtk_widget_get_clipboard(sk_tab->vte, selection);
+	/* The tab could be closed before the text arrives */
+	gtk_clipboard_request_text(clipboard, sakura_paste_received_cb, g_object_ref(sk_tab->vte));
+#else
+	/* Without vte_terminal_paste_text there's no way to know if the child wants bracketed
+	 * pastes, so vte pastes the whole text, without chunks */
+	if (selection == GDK_SELECTION_PRIMARY) {
+		vte_terminal_paste_primary(VTE_TERMINAL(sk_tab->vte));
+	} else {
+		vte_terminal_paste_clipboard(VTE_TERMINAL(sk_tab->vte));
+	}
+#endif
+}
 
-		/* Use background color to make text visible when the cursor is over it */
-		vte_terminal_set_color_cursor_foreground(VTE_TERMINAL(sk_tab->vte), &sakura.backcolors[sk_tab->colorset]);
 
-		vte_terminal_set_bold_is_bright(VTE_TERMINAL(sk_tab->vte), sakura.bold_is_bright);
+#if VTE_CHECK_VERSION(0, 68, 0)
+static void
+sakura_paste_received_cb (GtkClipboard *clipboard, const gchar *text, gpointer data)
+{
+	GtkWidget *vte = GTK_WIDGET(data);
+	struct sakura_tab *sk_tab;
+	gint page;
 
+	if (text && gtk_notebook_get_n_pages(GTK_NOTEBOOK(sakura.notebook)) > 0) {
+		page = sakura_find_tab(VTE_TERMINAL(vte));
+		if (page >= 0) {
+			sk_tab = sakura_get_sktab(sakura, page);
+			sakura_paste_text(sk_tab, text, strlen(text));
+		}
 	}
 
-	/* Main window opacity must be set. Otherwise vte widget will remain opaque */
-	gtk_widget_set_opacity(sakura.main_window, sakura.backcolors[sk_tab->colorset].alpha);
+	g_object_unref(vte);
 }
 
 
+/* Small texts are pasted at once by vte. Bigger ones are written in chunks from a low priority
+ * watch, only when the pty is writable, so the UI keeps working and the child is not flooded.
+ * vte pastes every chunk, as a bracketed paste if the child wants them */
 static void
-sakura_move_tab(gint direction)
+sakura_paste_text (struct sakura_tab *sk_tab, const gchar *text, gsize len)
 {
-	gint page, n_pages;
-	GtkWidget *child;
-
-	page = gtk_notebook_get_current_page(GTK_NOTEBOOK(sakura.notebook));
-	n_pages = gtk_notebook_get_n_pages(GTK_NOTEBOOK(sakura.notebook));
-	child = gtk_notebook_get_nth_page(GTK_NOTEBOOK(sakura.notebook), page);
+	GBytes *bytes;
+	gchar *small;
 
-	if (direction == FORWARD) {
-		if (page != n_pages-1)
-			gtk_notebook_reorder_child(GTK_NOTEBOOK(sakura.notebook), child, page+1);
-	} else {
-		if (page != 0)
-			gtk_notebook_reorder_child(GTK_NOTEBOOK(sakura.notebook), child, page-1);
+	if (!sk_tab->paste && len <= PASTE_CHUNK_SIZE) {
+		small = g_strndup(text, len);
+		vte_terminal_paste_text(VTE_TERMINAL(sk_tab->vte), small);
+		g_free(small);
+		return;
 	}
-}
 
+	bytes = g_bytes_new(text, len);
+	sakura_paste_bytes(sk_tab, bytes);
+	g_bytes_unref(bytes);
+}
 
-/* Find the notebook page for the vte terminal passed as a parameter */
-static gint
-sakura_find_tab(VteTerminal *vte_term)
+/* Add text to the paste in progress, starting it if needed */
+static void
+sakura_paste_bytes (struct sakura_tab *sk_tab, GBytes *bytes)
 {
-	gint matched_page, page, n_pages;
-	struct sakura_tab *sk_tab;
+	struct sakura_paste_piece *piece;
 
-	n_pages = gtk_notebook_get_n_pages(GTK_NOTEBOOK(sakura.notebook));
+	if (g_bytes_get_size(bytes) == 0)
+		return;
 
-	matched_page = -1;
-	page = 0;
+	if (!sakura_paste_get(sk_tab))
+		return;
 
-	do {
-		sk_tab = sakura_get_sktab(sakura, page);
-		if ((VteTerminal *)sk_tab->vte == vte_term) {
-			matched_page=page;
-		}
-		page++;
-	} while (page < n_pages);
+	piece = g_new0(struct sakura_paste_piece, 1);
+	piece->bytes = g_bytes_ref(bytes);
+	g_queue_push_tail(sk_tab->paste->pieces, piece);
+	sk_tab->paste->total += g_bytes_get_size(bytes);
 
-	return (matched_page);
+	sakura_paste_show_progress(sk_tab->paste);
 }
+#endif
 
 
-static void
-sakura_set_tab_label_text(const gchar *title, gint page)
+/* The paste in progress, started if needed. NULL if the tab can't take it */
+static struct sakura_paste *
+sakura_paste_get (struct sakura_tab *sk_tab)
 {
-	struct sakura_tab *sk_tab;
-	gchar *chopped_title;
-	gchar *default_label_text;
+	struct sakura_paste *paste;
 
-	sk_tab = sakura_get_sktab(sakura, page);
+	if (sk_tab->paste)
+		return sk_tab->paste;
 
-	if ((title != NULL) && (g_strcmp0(title, "") != 0)) {
-		/* Chop to max size */
-		chopped_title = g_strndup(title, TAB_MAX_SIZE);
-		/* Honor the minimum tab label size */
-		while (strlen(chopped_title)< TAB_MIN_SIZE) {
-			char *old_ptr = chopped_title;
-			chopped_title = g_strconcat(chopped_title, " ", NULL);
-			free(old_ptr);
+	if (!sakura_paste_takes_input(sk_tab))
+		return NULL;
+
+	paste = g_new0(struct sakura_paste, 1);
+	paste->sk_tab = sk_tab;
+	paste->pieces = g_queue_new();
+	paste->label = g_strdup(gtk_label_get_text(GTK_LABEL(sk_tab->label)));
+	paste->percent = G_MAXUINT;
+	paste->cancellable = g_cancellable_new();
+	sk_tab->paste = paste;
+	sakura_paste_schedule(paste);
+
+	return paste;
+}
+
+
+/* Tabs with a child, and feed tabs with an output stream (serial and socket tabs) */
+static bool
+sakura_paste_takes_input (struct sakura_tab *sk_tab)
+{
+	if (sk_tab->feed)
+		return sk_tab->feed->output != NULL;
+
+	return sakura_tab_get_pty_fd(sk_tab) >= 0;
+}
+
+
+/* Write the pieces when the pty can take them. Feed tabs have no pty: the chunks go through
+ * the feed input, and the next one is written when the previous write has finished */
+static void
+sakura_paste_schedule (struct sakura_paste *paste)
+{
+	struct sakura_feed *feed = paste->sk_tab->feed;
+
+	if (paste->watch_id)
+		return;
+
+	if (feed) {
+		if (!feed->writing)
+			paste->watch_id = g_idle_add_full(G_PRIORITY_LOW, sakura_paste_idle_cb, paste, NULL);
+		return;
+	}
+
+	paste->watch_id = g_unix_fd_add_full(G_PRIORITY_LOW, sakura_tab_get_pty_fd(paste->sk_tab), G_IO_OUT,
+	                                     sakura_paste_write_cb, paste, NULL);
+}
+
+
+/* Feed tabs. A chunk starts a write, sakura_feed_write_cb schedules us again when it's done */
+static gboolean
+sakura_paste_idle_cb (gpointer data)
+{
+	struct sakura_paste *paste = (struct sakura_paste *) data;
+
+	paste->watch_id = 0;
+
+	/* Typed input is being written */
+	if (paste->sk_tab->feed->writing)
+		return G_SOURCE_REMOVE;
+
+	if (sakura_paste_write(paste))
+		sakura_paste_schedule(paste);
+
+	return G_SOURCE_REMOVE;
+}
+
+
+/* Queue the start (1) or the end (-1) of a bracketed paste, the child gets them as they are */
+static void
+sakura_paste_marker (struct sakura_tab *sk_tab, gint bracket)
+{
+	struct sakura_paste_piece *piece;
+	const char *marker = bracket > 0 ? BRACKETED_PASTE_START : BRACKETED_PASTE_END;
+
+	if (!sakura_paste_get(sk_tab))
+		return;
+
+	piece = g_new0(struct sakura_paste_piece, 1);
+	piece->bytes = g_bytes_new_static(marker, strlen(marker));
+	piece->raw = true;
+	piece->bracket = bracket;
+	g_queue_push_tail(sk_tab->paste->pieces, piece);
+	sk_tab->paste->total += strlen(marker);
+}
+
+
+/* Add a file to the paste. It's read in parts, when the previous one has been written,
+ * so big files don't use our memory. Its size is only used for the progress */
+static void
+sakura_paste_stream (struct sakura_tab *sk_tab, GInputStream *stream, goffset size)
+{
+	struct sakura_paste *paste;
+	struct sakura_paste_piece *piece;
+
+	if (!(paste = sakura_paste_get(sk_tab)))
+		return;
+
+	piece = g_new0(struct sakura_paste_piece, 1);
+	piece->stream = g_object_ref(stream);
+	piece->raw = true;
+	g_queue_push_tail(paste->pieces, piece);
+	paste->total += size;
+	paste->unread += size;
+
+	sakura_paste_show_progress(paste);
+}
+
+
+static gboolean
+sakura_paste_write_cb (gint fd, GIOCondition condition, gpointer data)
+{
+	struct sakura_paste *paste = (struct sakura_paste *) data;
+	struct sakura_tab *sk_tab = paste->sk_tab;
+	guint watch_id;
+
+	if (condition & (G_IO_ERR | G_IO_HUP)) {
+		paste->watch_id = 0;
+		sakura_paste_stop(sk_tab);
+		return G_SOURCE_REMOVE;
+	}
+
+	/* The relay has not written the previous chunk yet */
+	if (sk_tab->relay && sk_tab->relay->pending->len > 0)
+		return G_SOURCE_CONTINUE;
+
+	/* Don't let sakura_paste_stop remove this source while it's dispatched */
+	watch_id = paste->watch_id;
+	paste->watch_id = 0;
+	if (!sakura_paste_write(paste))
+		return G_SOURCE_REMOVE;
+
+	paste->watch_id = watch_id;
+	return G_SOURCE_CONTINUE;
+}
+
+
+/* Write the next chunk. Returns false when the paste is over, and it has been freed, or
+ * when the next part of a file has to be read first (sakura_paste_read_cb goes on then) */
+static bool
+sakura_paste_write (struct sakura_paste *paste)
+{
+	struct sakura_tab *sk_tab = paste->sk_tab;
+	struct sakura_paste_piece *piece;
+	const gchar *chunk;
+	gsize size, len;
+
+	piece = g_queue_peek_head(paste->pieces);
+	if (piece->stream && (!piece->bytes || piece->offset >= g_bytes_get_size(piece->bytes))) {
+		if (!paste->reading) {
+			paste->reading = true;
+			g_input_stream_read_bytes_async(piece->stream, PASTE_READ_SIZE, G_PRIORITY_LOW, paste->cancellable,
+			                                sakura_paste_read_cb, paste);
+		}
+		return false;
+	}
+
+	chunk = (const gchar *) g_bytes_get_data(piece->bytes, &size) + piece->offset;
+	len = MIN(PASTE_CHUNK_SIZE, size - piece->offset);
+
+	/* Don't split UTF-8 characters or CRLFs between chunks of text */
+	if (!piece->raw && piece->offset + len < size) {
+		gsize end = len;
+		while (end > 0 && ((((guchar) chunk[end]) & 0xC0) == 0x80 || chunk[end - 1] == '\r'))
+			end--;
+		if (end > 0)
+			len = end;
+	}
+
+	sakura_paste_chunk(sk_tab, chunk, len, piece->raw);
+	piece->offset += len;
+	paste->written += len;
+
+	/* Files are done when the end is read */
+	if (!piece->stream && piece->offset >= size) {
+		if (piece->bracket)
+			paste->bracket_open = piece->bracket > 0;
+		sakura_paste_piece_free(g_queue_pop_head(paste->pieces));
+		if (g_queue_is_empty(paste->pieces)) {
+			sakura_paste_stop(sk_tab);
+			return false;
+		}
+	}
+
+	sakura_paste_show_progress(paste);
+
+	return true;
+}
+
+
+static void
+sakura_paste_read_cb (GObject *source, GAsyncResult *result, gpointer data)
+{
+	struct sakura_paste *paste = (struct sakura_paste *) data;
+	struct sakura_paste_piece *piece;
+	struct sakura_tab *sk_tab;
+	GError *error = NULL;
+	GBytes *bytes;
+
+	bytes = g_input_stream_read_bytes_finish(G_INPUT_STREAM(source), result, &error);
+
+	/* The paste has been stopped, and freed */
+	if (g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+		g_error_free(error);
+		return;
+	}
+
+	paste->reading = false;
+	sk_tab = paste->sk_tab;
+	piece = g_queue_peek_head(paste->pieces);
+
+	if (!bytes) {
+		sakura_paste_stop(sk_tab);
+		sakura_error("Couldn't read the pasted file: %s", error->message);
+		g_error_free(error);
+		return;
+	}
+
+	g_clear_pointer(&piece->bytes, g_bytes_unref);
+	piece->offset = 0;
+
+	if (g_bytes_get_size(bytes) == 0) {  /* End of file */
+		g_bytes_unref(bytes);
+		sakura_paste_piece_free(g_queue_pop_head(paste->pieces));
+		if (g_queue_is_empty(paste->pieces)) {
+			sakura_paste_stop(sk_tab);
+			return;
+		}
+	} else {
+		piece->bytes = bytes;
+		paste->unread -= MIN(paste->unread, g_bytes_get_size(bytes));
+	}
+
+	sakura_paste_schedule(paste);
+}
+
+
+/* Write a chunk to the child. Text is pasted by vte, which knows if the child wants
+ * bracketed pastes, converts the newlines and drops the control characters */
+static void
+sakura_paste_chunk (struct sakura_tab *sk_tab, const gchar *text, gsize len, bool raw)
+{
+#if VTE_CHECK_VERSION(0, 68, 0)
+	gchar *chunk;
+
+	if (!raw) {
+		chunk = g_strndup(text, len);
+		vte_terminal_paste_text(VTE_TERMINAL(sk_tab->vte), chunk);
+		g_free(chunk);
+		return;
+	}
+#endif
+
+	vte_terminal_feed_child(VTE_TERMINAL(sk_tab->vte), text, len);
+}
+
+
+static void
+sakura_paste_show_progress (struct sakura_paste *paste)
+{
+	guint percent;
+	gchar *label;
+
+	/* Files can change while they are pasted */
+	percent = paste->total ? (guint) MIN(paste->written * 100 / paste->total, 100) : 0;
+	if (percent == paste->percent)
+		return;
+
+	paste->percent = percent;
+	label = g_strdup_printf("%u%% %s", percent, paste->label);
+	gtk_label_set_text(GTK_LABEL(paste->sk_tab->label), label);
+	g_free(label);
+}
+
+
+/* Write a file to the pty. It's read in parts, not mapped, so a file truncated while it's
+ * pasted (a rotated log, a file in NFS) can't crash us with SIGBUS */
+static void
+sakura_paste_file (struct sakura_tab *sk_tab, const gchar *filename, bool bracketed)
+{
+	GFile *file;
+	GFileInputStream *stream;
+	GFileInfo *info;
+	GError *error = NULL;
+	goffset size = 0;
+
+	if (!sakura_paste_takes_input(sk_tab)) {
+		sakura_error("This tab doesn't take input");
+		return;
+	}
+
+	file = g_file_new_for_path(filename);
+	stream = g_file_read(file, NULL, &error);
+	g_object_unref(file);
+	if (!stream) {
+		sakura_error("Couldn't open \"%s\": %s", filename, error->message);
+		g_error_free(error);
+		return;
+	}
+
+	info = g_file_input_stream_query_info(stream, G_FILE_ATTRIBUTE_STANDARD_SIZE, NULL, NULL);
+	if (info) {
+		size = g_file_info_get_size(info);
+		g_object_unref(info);
+	}
+
+	if (bracketed)
+		sakura_paste_marker(sk_tab, 1);
+
+	sakura_paste_stream(sk_tab, G_INPUT_STREAM(stream), size);
+	g_object_unref(stream);
+
+	if (bracketed)
+		sakura_paste_marker(sk_tab, -1);
+}
+
+
+static void
+sakura_paste_file_dialog ()
+{
+	GtkWidget *file_dialog, *bracketed_check;
+	gint response;
+	gint page;
+	struct sakura_tab *sk_tab;
+	gchar *filename;
+
+	file_dialog = gtk_file_chooser_dialog_new(_("Paste file"),
+	                                          GTK_WINDOW(sakura.main_window),
+	                                          GTK_FILE_CHOOSER_ACTION_OPEN,
+	                                          _("_Cancel"), GTK_RESPONSE_CANCEL,
+	                                          _("_Paste"), GTK_RESPONSE_ACCEPT,
+	                                          NULL);
+	gtk_dialog_set_default_response(GTK_DIALOG(file_dialog), GTK_RESPONSE_ACCEPT);
+
+	/* Wrap the contents in the bracketed paste sequences, for programs that would run them line by line */
+	bracketed_check = gtk_check_button_new_with_label(_("Bracketed paste"));
+	gtk_file_chooser_set_extra_widget(GTK_FILE_CHOOSER(file_dialog), bracketed_check);
+
+	response = gtk_dialog_run(GTK_DIALOG(file_dialog));
+	if (response == GTK_RESPONSE_ACCEPT) {
+		filename = gtk_file_chooser_get_filename(GTK_FILE_CHOOSER(file_dialog));
+		if (filename) {
+			/* The tab could have been closed while the dialog was open */
+			page = gtk_notebook_get_current_page(GTK_NOTEBOOK(sakura.notebook));
+			sk_tab = sakura_get_sktab(sakura, page);
+			sakura_paste_file(sk_tab, filename,
+			                  gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(bracketed_check)));
+			g_free(filename);
+		}
+	}
+	gtk_widget_destroy(file_dialog);
+}
+
+
+static void
+sakura_paste_piece_free (gpointer data)
+{
+	struct sakura_paste_piece *piece = (struct sakura_paste_piece *) data;
+
+	if (piece->bytes)
+		g_bytes_unref(piece->bytes);
+	if (piece->stream)
+		g_object_unref(piece->stream);
+	g_free(piece);
+}
+
+
+/* Finish or cancel the paste in progress */
+static void
+sakura_paste_stop (struct sakura_tab *sk_tab)
+{
+	struct sakura_paste *paste = sk_tab->paste;
+
+	if (!paste)
+		return;
+
+	if (paste->watch_id)
+		g_source_remove(paste->watch_id);
+
+	/* A file read in progress ends with a cancelled error */
+	g_cancellable_cancel(paste->cancellable);
+	g_object_unref(paste->cancellable);
+
+	sk_tab->paste = NULL;
+	gtk_label_set_text(GTK_LABEL(sk_tab->label), paste->label);
+
+	/* A cancelled bracketed paste is ended, or the child would take what is typed next as pasted */
+	if (paste->bracket_open)
+		sakura_paste_chunk(sk_tab, BRACKETED_PASTE_END, strlen(BRACKETED_PASTE_END), true);
+
+	g_queue_free_full(paste->pieces, sakura_paste_piece_free);
+	g_free(paste->label);
+	g_free(paste);
+}
+
+
+static void
+sakura_show_scrollbar (void)
+{
+	gint page, n_pages;
+	struct sakura_tab *sk_tab;
+	int i;
+
+	n_pages = gtk_notebook_get_n_pages(GTK_NOTEBOOK(sakura.notebook));
+	page = gtk_notebook_get_current_page(GTK_NOTEBOOK(sakura.notebook));
+	sk_tab = sakura_get_sktab(sakura, page);
+
+	if (!g_key_file_get_boolean(sakura.cfg, cfg_group, "scrollbar", NULL)) {
+		sakura.show_scrollbar = true;
+		sakura_set_config_boolean("scrollbar", TRUE);
+	} else {
+		sakura.show_scrollbar = false;
+		sakura_set_config_boolean("scrollbar", FALSE);
+	}
+
+	/* Toggle/Untoggle the scrollbar for all tabs */
+	for (i = (n_pages - 1); i >= 0; i--) {
+		sk_tab = sakura_get_sktab(sakura, i);
+		if (!sakura.show_scrollbar)
+			gtk_widget_hide(sk_tab->scrollbar);
+		else
+			gtk_widget_show(sk_tab->scrollbar);
+	}
+	sakura_set_size();
+}
+
+
+static void
+sakura_set_size (void)
+{
+	struct sakura_tab *sk_tab;
+	gint pad_x, pad_y;
+	gint char_width, char_height;
+	guint npages;
+	gint min_width, natural_width;
+	gint page;
+	STATS_SCOPE("sakura_set_size");
+
+
+	sk_tab = sakura_get_sktab(sakura, 0);
+	npages = gtk_notebook_get_n_pages(GTK_NOTEBOOK(sakura.notebook));
+
+	/* Mayhaps an user resize happened. Check if row and columns have changed */
+	if (sakura.resized) {
+		sakura.columns = vte_terminal_get_column_count(VTE_TERMINAL(sk_tab->vte));
+		sakura.rows = vte_terminal_get_row_count(VTE_TERMINAL(sk_tab->vte));
+		sakura_trace(TRACE_RESIZE, sakura.columns, sakura.rows);
+		SAY("New columns %ld and rows %ld", sakura.columns, sakura.rows);
+		sakura.resized = FALSE;
+	}
+
+	gtk_style_context_get_padding(gtk_widget_get_style_context(sk_tab->vte),
+		gtk_widget_get_state_flags(sk_tab->vte),
+		&sk_tab->padding);
+	pad_x = sk_tab->padding.left + sk_tab->padding.right;
+	pad_y = sk_tab->padding.top + sk_tab->padding.bottom;
+	//SAY("padding x %d y %d", pad_x, pad_y);
+	char_width = vte_terminal_get_char_width(VTE_TERMINAL(sk_tab->vte));
+	char_height = vte_terminal_get_char_height(VTE_TERMINAL(sk_tab->vte));
+	char_height = (int) (sakura.line_height * char_height);
+
+	sakura.width = pad_x + (char_width * sakura.columns);
+	sakura.height = pad_y + (char_height * sakura.rows);
+
+	if (sakura.show_tab_bar == SHOW_TAB_BAR_ALWAYS || (sakura.show_tab_bar == SHOW_TAB_BAR_MULTIPLE && npages > 1)) {
+
+		/* TODO: Yeah i know, this is utter shit. Remove this ugly hack and set geometry hints*/
+		if (!sakura.show_scrollbar)
+			//sakura.height += min_height - 10;
+			sakura.height += 10;
+		else
+			//sakura.height += min_height - 47;
+			sakura.height += 47;
+
+		sakura.width += 8;
+		sakura.width += /* (hb*2)+*/ (pad_x*2);
+	}
+
+	page = gtk_notebook_get_current_page(GTK_NOTEBOOK(sakura.notebook));
+	sk_tab = sakura_get_sktab(sakura, page);
+
+	gtk_widget_get_preferred_width(sk_tab->scrollbar, &min_width, &natural_width);
+	//SAY("SCROLLBAR min width %d natural width %d", min_width, natural_width);
+	if (sakura.show_scrollbar) {
+		sakura.width += min_width;
+	}
+
+	/* Maximize window at init time when command line option is used */
+	if (option_maximize && sakura.first_run) {
+		gtk_window_maximize(GTK_WINDOW(sakura.main_window));
+		gtk_widget_show_all(GTK_WIDGET(sakura.main_window));
+		return; /* No need to resize */
+	}
+
+	gtk_window_resize(GTK_WINDOW(sakura.main_window), sakura.width, sakura.height);
+	SAY("Resized to %d %d", sakura.width, sakura.height);
+}
+
+
+static void
+sakura_set_font()
+{
+	gint n_pages;
+	struct sakura_tab *sk_tab;
+	int i;
+
+	n_pages=gtk_notebook_get_n_pages(GTK_NOTEBOOK(sakura.notebook));
+
+	/* Set the font for all tabs */
+	for (i = (n_pages - 1); i >= 0; i--) {
+		sk_tab = sakura_get_sktab(sakura, i);
+		vte_terminal_set_font(VTE_TERMINAL(sk_tab->vte), sakura.font);
+		vte_terminal_set_cell_height_scale(VTE_TERMINAL(sk_tab->vte), sakura.line_height);
+	}
+}
+
+/* Set colorset when colosert keybinding is used */
+static void
+sakura_set_colorset (int cs)
+{
+	gint page;
+	struct sakura_tab *sk_tab;
+
+	if (cs < 0 || cs >= NUM_COLORSETS)
+		return;
+
+	page = gtk_notebook_get_current_page(GTK_NOTEBOOK(sakura.notebook));
+	sk_tab = sakura_get_sktab(sakura, page);
+	sk_tab->colorset = cs;
+
+	sakura_set_config_integer("last_colorset", sk_tab->colorset+1);
+
+	sakura_set_colors();
+}
+
+
+/* Blend a color with black to dim it. Alpha is kept, so transparency doesn't change */
+static void
+sakura_fade_color (GdkRGBA *faded, const GdkRGBA *color)
+{
+	faded->red = color->red * (1.0 - FADE_AMOUNT);
+	faded->green = color->green * (1.0 - FADE_AMOUNT);
+	faded->blue = color->blue * (1.0 - FADE_AMOUNT);
+	faded->alpha = color->alpha;
+}
+
+
+/* Set the terminal colors for all notebook tabs */
+static void
+sakura_set_colors ()
+{
+	int i;
+	int n_pages = gtk_notebook_get_n_pages(GTK_NOTEBOOK(sakura.notebook));
+	struct sakura_tab *sk_tab;
+
+	/* Compute the dimmed colors now, so focus changes only need to set them */
+	for (i = 0; i < PALETTE_SIZE; i++) {
+		sakura_fade_color(&sakura.faded_palette[i], &sakura.palette[i]);
+	}
+	for (i = 0; i < NUM_COLORSETS; i++) {
+		sakura_fade_color(&sakura.faded_forecolors[i], &sakura.forecolors[i]);
+		sakura_fade_color(&sakura.faded_backcolors[i], &sakura.backcolors[i]);
+		sakura_fade_color(&sakura.faded_curscolors[i], &sakura.curscolors[i]);
+	}
+
+	for (i = (n_pages - 1); i >= 0; i--) {
+		sk_tab = sakura_get_sktab(sakura, i);
+		sakura_set_tab_colors(sk_tab);
+		vte_terminal_set_bold_is_bright(VTE_TERMINAL(sk_tab->vte), sakura.bold_is_bright);
+	}
+
+	/* Transparency may have been enabled or disabled, so check the visual is still the right one */
+	sakura_set_visual(sakura_uses_transparency());
+
+	/* Main window opacity must be set. Otherwise vte widget will remain opaque. Don't touch
+	 * it in opaque windows, the compositor would blend the whole window on every frame */
+	if (sakura.rgba_visual || gtk_widget_get_opacity(sakura.main_window) != 1.0) {
+		gtk_widget_set_opacity(sakura.main_window, sakura.backcolors[sk_tab->colorset].alpha);
+	}
+}
+
+
+/* Set fore, back, cursor color and palette for the terminal's colorset, dimmed or not */
+static void
+sakura_set_tab_colors (struct sakura_tab *sk_tab)
+{
+	const GdkRGBA *fore, *back, *curs, *palette;
+
+	if (sakura.faded) {
+		fore = &sakura.faded_forecolors[sk_tab->colorset];
+		back = &sakura.faded_backcolors[sk_tab->colorset];
+		curs = &sakura.faded_curscolors[sk_tab->colorset];
+		palette = sakura.faded_palette;
+	} else {
+		fore = &sakura.forecolors[sk_tab->colorset];
+		back = &sakura.backcolors[sk_tab->colorset];
+		curs = &sakura.curscolors[sk_tab->colorset];
+		palette = sakura.palette;
+	}
+
+	vte_terminal_set_colors(VTE_TERMINAL(sk_tab->vte), fore, back, palette, PALETTE_SIZE);
+	vte_terminal_set_color_cursor(VTE_TERMINAL(sk_tab->vte), curs);
+
+	/* Use background color to make text visible when the cursor is over it */
+	vte_terminal_set_color_cursor_foreground(VTE_TERMINAL(sk_tab->vte), back);
+}
+
+
+/* Check if any colorset has a transparent background. The throughput profile always uses opaque windows */
+static bool
+sakura_uses_transparency (void)
+{
+	int i;
+
+	/* Unless the command tabs use the default profile */
+	if (sakura.throughput && (!sakura.command_profile || sakura.command_throughput))
+		return false;
+
+	for (i = 0; i < NUM_COLORSETS; i++) {
+		if (sakura.backcolors[i].alpha < 1.0)
+			return true;
+	}
+
+	return false;
+}
+
+
+/* Select the rgba visual for transparent windows and the system one (no alpha channel) for opaque
+ * windows. The visual of a realized window can't be changed, so the window is recreated if needed,
+ * keeping its position, size and state */
+static void
+sakura_set_visual (bool rgba)
+{
+	GdkScreen *screen;
+	GdkVisual *visual;
+	GdkWindowState state;
+	gint x, y, width, height;
+
+	screen = gtk_widget_get_screen(GTK_WIDGET(sakura.main_window));
+
+	/* Without compositing manager transparency won't work as expected */
+	if (rgba && (gdk_screen_get_rgba_visual(screen) == NULL || !gdk_screen_is_composited(screen)))
+		rgba = false;
+
+	visual = rgba ? gdk_screen_get_rgba_visual(screen) : gdk_screen_get_system_visual(screen);
+	if (visual == gtk_widget_get_visual(sakura.main_window))
+		return;
+
+	INFO("Using %s visual", rgba ? "rgba" : "system");
+	sakura.rgba_visual = rgba;
+
+	if (gtk_widget_get_realized(sakura.main_window)) {
+		state = gdk_window_get_state(gtk_widget_get_window(sakura.main_window));
+		gtk_window_get_position(GTK_WINDOW(sakura.main_window), &x, &y);
+		gtk_window_get_size(GTK_WINDOW(sakura.main_window), &width, &height);
+
+		/* Withdrawing the window must not suspend the terminals */
+		sakura.recreating_window = true;
+		gtk_widget_hide(sakura.main_window);
+		gtk_widget_unrealize(sakura.main_window);
+		gtk_widget_set_visual(sakura.main_window, visual);
+		gtk_window_move(GTK_WINDOW(sakura.main_window), x, y);
+		gtk_window_resize(GTK_WINDOW(sakura.main_window), width, height);
+
+		/* Applied when the new window is mapped */
+		if (state & GDK_WINDOW_STATE_MAXIMIZED)
+			gtk_window_maximize(GTK_WINDOW(sakura.main_window));
+		if (state & GDK_WINDOW_STATE_FULLSCREEN)
+			gtk_window_fullscreen(GTK_WINDOW(sakura.main_window));
+		if (state & GDK_WINDOW_STATE_STICKY)
+			gtk_window_stick(GTK_WINDOW(sakura.main_window));
+		gtk_window_set_keep_above(GTK_WINDOW(sakura.main_window), (state & GDK_WINDOW_STATE_ABOVE) != 0);
+		gtk_window_set_keep_below(GTK_WINDOW(sakura.main_window), (state & GDK_WINDOW_STATE_BELOW) != 0);
+
+		gtk_widget_show(sakura.main_window);
+		sakura.recreating_window = false;
+
+		/* The children started from now on get the new window */
+		sakura_set_windowid(true);
+	} else {
+		gtk_widget_set_visual(sakura.main_window, visual);
+	}
+}
+
+
+/* Set the WINDOWID env variable for our children */
+static void
+sakura_set_windowid (bool overwrite)
+{
+#ifdef GDK_WINDOWING_X11
+	GdkDisplay *display = gdk_display_get_default();
+
+	if (GDK_IS_X11_DISPLAY (display)) {
+		GdkWindow *gwin = gtk_widget_get_window (sakura.main_window);
+		if (gwin != NULL) {
+			guint winid = gdk_x11_window_get_xid (gwin);
+			gchar *winidstr = g_strdup_printf ("%d", winid);
+			g_setenv ("WINDOWID", winidstr, overwrite);
+			g_free (winidstr);
+		}
+	}
+#endif
+}
+
+
+/* Add or remove the link regexes to the terminal. VTE checks the added regexes while
+ * the pointer moves over the text, which is expensive for very long lines */
+static void
+sakura_set_link_matching (struct sakura_tab *sk_tab, bool matching)
+{
+	guint i;
+
+	if (matching == sk_tab->matching)
+		return;
+
+	sk_tab->matching = matching;
+
+	if (matching) {
+		/* User defined matchers go first, so they take precedence over the builtin ones */
+		for (i = 0; i < sakura.matcher_vteregexps->len; i++) {
+			vte_terminal_match_add_regex(VTE_TERMINAL(sk_tab->vte), g_ptr_array_index(sakura.matcher_vteregexps, i), 0);
+		}
+		sk_tab->http_tag = vte_terminal_match_add_regex(VTE_TERMINAL(sk_tab->vte), sakura.http_vteregexp, PCRE2_CASELESS);
+		sk_tab->mail_tag = vte_terminal_match_add_regex(VTE_TERMINAL(sk_tab->vte), sakura.mail_vteregexp, PCRE2_CASELESS);
+	} else {
+		vte_terminal_match_remove_all(VTE_TERMINAL(sk_tab->vte));
+		sk_tab->http_tag = sk_tab->mail_tag = -1;
+	}
+}
+
+
+/* Remove the link regexes from all the terminals */
+static void
+sakura_disable_link_matching (void)
+{
+	struct sakura_tab *sk_tab;
+	int i, n_pages;
+
+	n_pages = gtk_notebook_get_n_pages(GTK_NOTEBOOK(sakura.notebook));
+	for (i = (n_pages - 1); i >= 0; i--) {
+		sk_tab = sakura_get_sktab(sakura, i);
+		sakura_set_link_matching(sk_tab, false);
+	}
+}
+
+
+/* Get the link under the pointer of the event, if any, and its type */
+static char *
+sakura_check_link (struct sakura_tab *sk_tab, GdkEvent *event, LinkType *link_type)
+{
+	VteRegex **regexes;
+	char **matches;
+	char *match = NULL;
+	guint i, n_regexes;
+	int tag;
+
+	*link_type = LINK_URL;
+
+	/* Explicit OSC 8 hyperlinks go first. Too long URIs are ignored, they only come from broken or hostile output */
+	if (sakura.hyperlinks) {
+		match = vte_terminal_hyperlink_check_event(VTE_TERMINAL(sk_tab->vte), event);
+		if (match && strlen(match) <= sakura.hyperlink_max_length) {
+			if (g_str_has_prefix(match, "mailto:")) {
+				*link_type = LINK_MAIL;
+			}
+			return match;
+		}
+		g_free(match); match = NULL;
+	}
+
+	if (sk_tab->matching) {
+		match = vte_terminal_match_check_event(VTE_TERMINAL(sk_tab->vte), event, &tag);
+		if (match && tag == sk_tab->mail_tag) {
+			*link_type = LINK_MAIL;
+		} else if (match && tag != sk_tab->http_tag) {
+			*link_type = LINK_MATCHER;
+		}
+	} else if (sakura.link_detection == LINK_DETECTION_MODIFIER && !sk_tab->throughput) {
+		/* Regexes are not added to the terminal, so check them only for this event. Same order as
+		 * in sakura_set_link_matching: user defined matchers, http and mail */
+		n_regexes = sakura.matcher_vteregexps->len + 2;
+		regexes = g_new(VteRegex *, n_regexes);
+		matches = g_new0(char *, n_regexes);
+		for (i = 0; i < sakura.matcher_vteregexps->len; i++) {
+			regexes[i] = g_ptr_array_index(sakura.matcher_vteregexps, i);
+		}
+		regexes[n_regexes-2] = sakura.http_vteregexp;
+		regexes[n_regexes-1] = sakura.mail_vteregexp;
+
+		if (vte_terminal_event_check_regex_simple(VTE_TERMINAL(sk_tab->vte), event, regexes, n_regexes, 0, matches)) {
+			for (i = 0; i < n_regexes; i++) {
+				if (!match && matches[i]) {
+					match = matches[i];
+					if (i == n_regexes-1) {
+						*link_type = LINK_MAIL;
+					} else if (i < n_regexes-2) {
+						*link_type = LINK_MATCHER;
+					}
+				} else {
+					g_free(matches[i]);
+				}
+			}
+		}
+
+		g_free(regexes);
+		g_free(matches);
+	}
+
+	return match;
+}
+
+
+/* Sort matchers by priority, higher first */
+static gint
+sakura_matcher_compare (gconstpointer a, gconstpointer b)
+{
+	const struct sakura_matcher *ma = *(const struct sakura_matcher **)a;
+	const struct sakura_matcher *mb = *(const struct sakura_matcher **)b;
+
+	/* Not a subtraction, it would overflow with extreme priorities */
+	return (mb->priority > ma->priority) - (mb->priority < ma->priority);
+}
+
+
+/* Compile a regex for vte, using the pcre2 JIT compiler if available */
+static VteRegex *
+sakura_new_jit_regex (const char *pattern, GError **gerror)
+{
+	VteRegex *regex;
+
+	regex = vte_regex_new_for_match(pattern, strlen(pattern), PCRE2_MULTILINE, gerror);
+	if (regex) {
+		/* JIT is not available in every platform. Without it, the interpreter is used */
+		vte_regex_jit(regex, PCRE2_JIT_COMPLETE, NULL);
+		vte_regex_jit(regex, PCRE2_JIT_PARTIAL_SOFT, NULL);
+	}
+
+	return regex;
+}
+
+
+/* Load the user defined matchers from the [matchers] config group. Each matcher NAME has
+ * the NAME_pattern, NAME_action and NAME_priority keys. Patterns are compiled only once, and
+ * combined in a single alternation (in priority order) to not multiply the matching cost */
+static void
+sakura_load_matchers (void)
+{
+	gchar **keys; gsize n_keys, i;
+	struct sakura_matcher *matcher;
+	GString *combined; guint n_combined = 0;
+	GPtrArray *separate;
+	GError *gerror = NULL;
+	VteRegex *regex;
+
+	sakura.matchers = g_ptr_array_new();
+	sakura.matcher_vteregexps = g_ptr_array_new_with_free_func((GDestroyNotify)vte_regex_unref);
+
+	keys = g_key_file_get_keys(sakura.cfg, MATCHERS_GROUP, &n_keys, NULL);
+	if (!keys) return;
+
+	for (i = 0; i < n_keys; i++) {
+		if (!g_str_has_suffix(keys[i], "_pattern")) continue;
+
+		gchar *name = g_strndup(keys[i], strlen(keys[i]) - strlen("_pattern"));
+		gchar *key;
+
+		matcher = g_new0(struct sakura_matcher, 1);
+		matcher->name = name;
+		matcher->pattern = g_key_file_get_string(sakura.cfg, MATCHERS_GROUP, keys[i], NULL);
+
+		key = g_strdup_printf("%s_action", name);
+		matcher->action = g_key_file_get_string(sakura.cfg, MATCHERS_GROUP, key, NULL);
+		if (!matcher->action) matcher->action = g_strdup("copy");
+		g_free(key);
+
+		key = g_strdup_printf("%s_priority", name);
+		matcher->priority = g_key_file_get_integer(sakura.cfg, MATCHERS_GROUP, key, NULL);
+		g_free(key);
+
+		/* Check the pattern and build the regex used to know which matcher matched the text */
+		gchar *full_pattern = g_strdup_printf("^(?:%s)$", matcher->pattern);
+		matcher->regex = g_regex_new(full_pattern, 0, 0, &gerror);
+		g_free(full_pattern);
+		if (!matcher->regex) {
+			fprintf(stderr, "Invalid pattern for matcher %s: %s\n", name, gerror->message);
+			g_clear_error(&gerror);
+			g_free(matcher->name); g_free(matcher->pattern); g_free(matcher->action); g_free(matcher);
+			continue;
+		}
+
+		g_ptr_array_add(sakura.matchers, matcher);
+	}
+	g_strfreev(keys);
+
+	g_ptr_array_sort(sakura.matchers, sakura_matcher_compare);
+
+	/* Combine all the patterns we can in one regex. The alternation keeps the priority order */
+	combined = g_string_new(NULL);
+	separate = g_ptr_array_new();
+	for (i = 0; i < sakura.matchers->len; i++) {
+		matcher = g_ptr_array_index(sakura.matchers, i);
+		if (g_regex_match_simple(BACKREF_REGEXP, matcher->pattern, 0, 0)) {
+			g_ptr_array_add(separate, matcher);
+		} else {
+			g_string_append_printf(combined, "%s(?:%s)", n_combined ? "|" : "", matcher->pattern);
+			n_combined++;
+		}
+	}
+
+	if (n_combined > 0) {
+		if ((regex = sakura_new_jit_regex(combined->str, &gerror))) {
+			g_ptr_array_add(sakura.matcher_vteregexps, regex);
+		} else {
+			/* Patterns can be incompatible (duplicated group names...), use them separately */
+			WARN("combined matchers regex: %s", gerror->message);
+			g_clear_error(&gerror);
+			g_ptr_array_set_size(separate, 0);
+			for (i = 0; i < sakura.matchers->len; i++) {
+				g_ptr_array_add(separate, g_ptr_array_index(sakura.matchers, i));
+			}
+		}
+	}
+
+	for (i = 0; i < separate->len; i++) {
+		matcher = g_ptr_array_index(separate, i);
+		if ((regex = sakura_new_jit_regex(matcher->pattern, &gerror))) {
+			g_ptr_array_add(sakura.matcher_vteregexps, regex);
+		} else {
+			fprintf(stderr, "Invalid pattern for matcher %s: %s\n", matcher->name, gerror->message);
+			g_clear_error(&gerror);
+		}
+	}
+
+	INFO("%u matchers loaded, %u regexes", sakura.matchers->len, sakura.matcher_vteregexps->len);
+
+	g_string_free(combined, TRUE);
+	g_ptr_array_free(separate, TRUE);
+}
+
+
+/* Find the matcher for a matched text, checking the matchers by priority */
+static const struct sakura_matcher *
+sakura_find_matcher (const char *text)
+{
+	struct sakura_matcher *matcher;
+	guint i;
+
+	for (i = 0; i < sakura.matchers->len; i++) {
+		matcher = g_ptr_array_index(sakura.matchers, i);
+		if (g_regex_match(matcher->regex, text, 0, NULL))
+			return matcher;
+	}
+
+	return NULL;
+}
+
+
+/* Execute the action of a matcher for the matched text */
+static void
+sakura_run_matcher (const struct sakura_matcher *matcher, const char *text)
+{
+	struct sakura_tab *sk_tab;
+	GError *error = NULL;
+	gchar **parts, *joined, *cwd;
+	gint page, argc, i;
+	gchar **argv;
+
+	SAY("Matcher %s: %s %s", matcher->name, matcher->action, text);
+
+	if (g_str_has_prefix(matcher->action, "open:")) {
+		/* Escape the text, it's going to be part of an URI */
+		gchar *escaped = g_uri_escape_string(text, G_URI_RESERVED_CHARS_ALLOWED_IN_PATH, FALSE);
+		parts = g_strsplit(matcher->action + strlen("open:"), "%s", -1);
+		joined = g_strjoinv(escaped, parts);
+		sakura_open_uri(joined);
+		g_free(joined); g_strfreev(parts); g_free(escaped);
+
+	} else if (g_str_has_prefix(matcher->action, "exec:")) {
+		/* Replace %s after splitting the command, so the text doesn't need to be quoted */
+		if (!g_shell_parse_argv(matcher->action + strlen("exec:"), &argc, &argv, &error)) {
+			sakura_error("Invalid command for matcher %s: %s", matcher->name, error->message);
+			g_error_free(error);
+			return;
+		}
+		for (i = 0; i < argc; i++) {
+			parts = g_strsplit(argv[i], "%s", -1);
+			g_free(argv[i]);
+			argv[i] = g_strjoinv(text, parts);
+			g_strfreev(parts);
+		}
+
+		/* Run the command in the terminal working directory, so relative paths work */
+		page = gtk_notebook_get_current_page(GTK_NOTEBOOK(sakura.notebook));
+		sk_tab = sakura_get_sktab(sakura, page);
+		if ((cwd = sakura_get_term_cwd_osc7(sk_tab)) == NULL)
+			cwd = sakura_get_term_cwd(sk_tab);
+
+		if (!g_spawn_async(cwd, argv, NULL, G_SPAWN_SEARCH_PATH, NULL, NULL, NULL, &error)) {
+			sakura_error("Couldn't exec \"%s\": %s", argv[0], error->message);
+			g_error_free(error);
+		}
+		g_free(cwd);
+		g_strfreev(argv);
+
+	} else if (strcmp(matcher->action, "copy") == 0) {
+		gtk_clipboard_set_text(gtk_clipboard_get(GDK_SELECTION_CLIPBOARD), text, -1);
+
+	} else {
+		sakura_error("Unknown action for matcher %s: %s", matcher->name, matcher->action);
+	}
+}
+
+
+/* Switch all the terminals between the dimmed and the original colors. The dimmed ones
+ * are computed by sakura_set_colors, and alpha is kept, so the visual and opacity stay */
+static void
+sakura_set_faded (bool faded)
+{
+	int i, n_pages;
+
+	if (faded == sakura.faded)
+		return;
+
+	sakura.faded = faded;
+
+	n_pages = gtk_notebook_get_n_pages(GTK_NOTEBOOK(sakura.notebook));
+	for (i = (n_pages - 1); i >= 0; i--) {
+		struct sakura_tab *sk_tab = sakura_get_sktab(sakura, i);
+		sakura_set_tab_colors(sk_tab);
+	}
+}
+
+
+/* Suspend or resume the terminals depending on the main window state. While the window
+ * is iconified or hidden, cursors don't blink, VTE doesn't draw and titles are not updated */
+static void
+sakura_set_suspended (void)
+{
+	struct sakura_tab *sk_tab;
+	int i, n_pages;
+	bool suspended = sakura.iconified || sakura.obscured;
+
+	if (suspended == sakura.suspended)
+		return;
+
+	sakura.suspended = suspended;
+	sakura_trace(TRACE_SUSPEND, suspended, 0);
+	SAY("%s", suspended ? "Suspending" : "Resuming");
+
+	n_pages = gtk_notebook_get_n_pages(GTK_NOTEBOOK(sakura.notebook));
+	for (i = (n_pages - 1); i >= 0; i--) {
+		sk_tab = sakura_get_sktab(sakura, i);
+
+		/* Catch up with the titles set while we were away */
+		if (!suspended && sk_tab->title_pending) {
+			sk_tab->title_pending = false;
+			sakura_title_changed_cb(sk_tab->vte, NULL);
+		}
+	}
+
+	sakura_set_cursor_blink();
+
+	/* Draws were skipped, so repaint everything */
+	if (!suspended)
+		gtk_widget_queue_draw(sakura.notebook);
+}
+
+
+/* Apply the blinking cursor option to all tabs. Cursors don't blink when we're
+ * suspended, nor in unfocused windows when low power mode is enabled */
+static void
+sakura_set_cursor_blink (void)
+{
+	struct sakura_tab *sk_tab;
+	int i, n_pages;
+	bool blink = sakura.blinking_cursor && !sakura.suspended && (sakura.has_focus || !sakura.low_power);
+
+	n_pages = gtk_notebook_get_n_pages(GTK_NOTEBOOK(sakura.notebook));
+	for (i = (n_pages - 1); i >= 0; i--) {
+		sk_tab = sakura_get_sktab(sakura, i);
+		vte_terminal_set_cursor_blink_mode(VTE_TERMINAL(sk_tab->vte),
+		                                   (blink && !sk_tab->throughput) ? VTE_CURSOR_BLINK_ON : VTE_CURSOR_BLINK_OFF);
+	}
+}
+
+
+static void
+sakura_move_tab(gint direction)
+{
+	gint page, n_pages;
+	GtkWidget *child;
+
+	page = gtk_notebook_get_current_page(GTK_NOTEBOOK(sakura.notebook));
+	n_pages = gtk_notebook_get_n_pages(GTK_NOTEBOOK(sakura.notebook));
+	child = gtk_notebook_get_nth_page(GTK_NOTEBOOK(sakura.notebook), page);
+
+	if (direction == FORWARD) {
+		if (page != n_pages-1)
+			gtk_notebook_reorder_child(GTK_NOTEBOOK(sakura.notebook), child, page+1);
+	} else {
+		if (page != 0)
+			gtk_notebook_reorder_child(GTK_NOTEBOOK(sakura.notebook), child, page-1);
+	}
+}
+
+
+/* Find the notebook page for the vte terminal passed as a parameter */
+static gint
+sakura_find_tab(VteTerminal *vte_term)
+{
+	gint matched_page, page, n_pages;
+	struct sakura_tab *sk_tab;
+
+	n_pages = gtk_notebook_get_n_pages(GTK_NOTEBOOK(sakura.notebook));
+
+	matched_page = -1;
+	page = 0;
+
+	do {
+		sk_tab = sakura_get_sktab(sakura, page);
+		if ((VteTerminal *)sk_tab->vte == vte_term) {
+			matched_page=page;
+		}
+		page++;
+	} while (page < n_pages);
+
+	return (matched_page);
+}
+
+
+static void
+sakura_set_tab_label_text(const gchar *title, gint page)
+{
+	struct sakura_tab *sk_tab;
+	gchar *label_text;
+
+	sk_tab = sakura_get_sktab(sakura, page);
+
+	label_text = sakura_tab_title(title, page);
+	gtk_label_set_text(GTK_LABEL(sk_tab->label), label_text);
+	g_free(label_text);
+
+	/* Keep showing the paste progress with the new label */
+	if (sk_tab->paste) {
+		g_free(sk_tab->paste->label);
+		sk_tab->paste->label = g_strdup(gtk_label_get_text(GTK_LABEL(sk_tab->label)));
+		sk_tab->paste->percent = G_MAXUINT;
+		sakura_paste_show_progress(sk_tab->paste);
+	}
+}
+
+
+/* Callback for vte_terminal_spawn_async */
+void
+sakura_spawn_callback (VteTerminal *vte, GPid pid, GError *error, gpointer user_data)
+{
+	struct sakura_tab *sk_tab = (struct sakura_tab *) user_data;
+
+	sakura_trace(TRACE_SPAWN, pid, 0);
+	if (pid == -1) { /* Fork has failed */
+		WARN("Error: %s", error->message);
+	} else {
+		sk_tab->pid=pid;
+		sakura_startup_trace(STARTUP_SPAWN);
+	}
+}
+
+
+/* Spawn the child of a tab. With OSC 52 or recording enabled the tab relays the child output, otherwise VTE
+ * does everything */
+static void
+sakura_spawn (struct sakura_tab *sk_tab, const char *cwd, char **argv, char **envv, GSpawnFlags flags)
+{
+	struct sakura_relay *relay;
+	GError *error = NULL;
+	VtePty *pty = NULL;
+
+	if ((sakura.osc52 || sakura.recording) && !sk_tab->throughput) {
+		if (!(pty = vte_pty_new_sync(VTE_PTY_NO_HELPER, NULL, &error))) {
+			WARN("Cannot create pty: %s", error->message);
+			g_error_free(error);
+		}
+	}
+
+	if (!pty) {
+		vte_terminal_spawn_async(VTE_TERMINAL(sk_tab->vte), VTE_PTY_NO_HELPER, cwd, argv, envv,
+		                         flags, NULL, NULL, NULL, -1, NULL, sakura_spawn_callback, sk_tab);
+		return;
+	}
+
+	relay = g_new0(struct sakura_relay, 1);
+	relay->sk_tab = sk_tab;
+	relay->pty = pty;
+	relay->pending = g_byte_array_new();
+	relay->osc52_data = g_byte_array_new();
+	relay->osc52_state = OSC52_NONE;
+	relay->rows = vte_terminal_get_row_count(VTE_TERMINAL(sk_tab->vte));
+	relay->columns = vte_terminal_get_column_count(VTE_TERMINAL(sk_tab->vte));
+	vte_pty_set_size(pty, relay->rows, relay->columns, NULL);
+
+	sk_tab->relay = relay;
+	sk_tab->osc52 = sakura.osc52;
+
+	/* Without a pty VTE gives us the input with the commit signal, and we have to resize the pty */
+	g_signal_connect(G_OBJECT(sk_tab->vte), "commit", G_CALLBACK(sakura_relay_commit_cb), relay);
+	g_signal_connect_after(G_OBJECT(sk_tab->vte), "size-allocate", G_CALLBACK(sakura_relay_size_allocate_cb), relay);
+
+	relay->spawning = true;
+	vte_pty_spawn_async(pty, cwd, argv, envv, flags, NULL, NULL, NULL, -1, NULL, sakura_relay_spawn_cb, relay);
+}
+
+
+static void
+sakura_relay_spawn_cb (GObject *source, GAsyncResult *result, gpointer data)
+{
+	struct sakura_relay *relay = (struct sakura_relay *) data;
+	GError *error = NULL;
+	GPid pid;
+
+	relay->spawning = false;
+
+	if (!vte_pty_spawn_finish(VTE_PTY(source), result, &pid, &error)) { /* Fork has failed */
+		sakura_trace(TRACE_SPAWN, -1, 0);
+		WARN("Error: %s", error->message);
+		g_error_free(error);
+		if (!relay->sk_tab) sakura_relay_free(relay);
+		return;
+	}
+
+	sakura_startup_trace(STARTUP_SPAWN);
+	sakura_trace(TRACE_SPAWN, pid, 0);
+
+	/* Watch the child even if the tab has already been closed, it must be reaped */
+	relay->child_watch_id = g_child_watch_add(pid, sakura_relay_child_watch_cb, relay);
+
+	if (relay->sk_tab) {
+		relay->sk_tab->pid = pid;
+		/* Low priority, like the other feeds: a flooding child keeps the fd readable, and
+		 * at default priority GDK would never get to redraw the window */
+		relay->read_id = g_unix_fd_add_full(G_PRIORITY_LOW, vte_pty_get_fd(relay->pty), G_IO_IN|G_IO_HUP|G_IO_ERR,
+		                                    sakura_relay_read_cb, relay, NULL);
+	}
+}
+
+
+/* Child output is available */
+static gboolean
+sakura_relay_read_cb (gint fd, GIOCondition condition, gpointer data)
+{
+	struct sakura_relay *relay = (struct sakura_relay *) data;
+	static char buffer[RELAY_BUFFER_SIZE];
+	ssize_t len;
+
+	/* Only one read each time, so big outputs don't block the main loop */
+	len = read(fd, buffer, sizeof(buffer));
+	if (len > 0) {
+		sakura_relay_output(relay, buffer, len);
+		return G_SOURCE_CONTINUE;
+	}
+
+	if (len < 0 && (errno == EAGAIN || errno == EINTR))
+		return G_SOURCE_CONTINUE;
+
+	/* EOF, or EIO when the child has closed the pty */
+	relay->read_id = 0;
+	return G_SOURCE_REMOVE;
+}
+
+
+/* The child has exited. Get its last output and tell the tab, as VTE does for not relayed tabs */
+static void
+sakura_relay_child_watch_cb (GPid pid, gint status, gpointer data)
+{
+	struct sakura_relay *relay = (struct sakura_relay *) data;
+	char buffer[4096];
+	ssize_t len;
+
+	relay->child_watch_id = 0;
+	g_spawn_close_pid(pid);
+
+	if (!relay->sk_tab) {
+		sakura_relay_free(relay);
+		return;
+	}
+
+	while ((len = read(vte_pty_get_fd(relay->pty), buffer, sizeof(buffer))) > 0) {
+		sakura_relay_output(relay, buffer, len);
+	}
+
+	/* The tab (and the relay) can be deleted by the signal handlers */
+	g_signal_emit_by_name(relay->sk_tab->vte, "child-exited", status);
+}
+
+
+/* Write the user input to the pty. What can't be written now is written when the pty is writable */
+static void
+sakura_relay_write (struct sakura_relay *relay, const char *data, gsize len)
+{
+	gint fd = vte_pty_get_fd(relay->pty);
+	ssize_t written = 0;
+
+	/* Don't mess the input order, only write directly if there's nothing pending */
+	if (relay->pending->len == 0) {
+		written = write(fd, data, len);
+		if (written < 0) {
+			if (errno != EAGAIN && errno != EINTR) return;
+			written = 0;
+		}
+	}
+
+	if (written < len) {
+		g_byte_array_append(relay->pending, (const guint8 *) data + written, len - written);
+		if (!relay->write_id)
+			relay->write_id = g_unix_fd_add(fd, G_IO_OUT, sakura_relay_write_cb, relay);
+	}
+}
+
+
+static gboolean
+sakura_relay_write_cb (gint fd, GIOCondition condition, gpointer data)
+{
+	struct sakura_relay *relay = (struct sakura_relay *) data;
+	ssize_t written;
+
+	written = write(fd, relay->pending->data, relay->pending->len);
+	if (written < 0) {
+		if (errno == EAGAIN || errno == EINTR)
+			return G_SOURCE_CONTINUE;
+		/* The child is gone, nobody is going to read it */
+		g_byte_array_set_size(relay->pending, 0);
+	} else {
+		g_byte_array_remove_range(relay->pending, 0, written);
+		if (relay->pending->len > 0)
+			return G_SOURCE_CONTINUE;
+	}
+
+	relay->write_id = 0;
+	return G_SOURCE_REMOVE;
+}
+
+
+static void
+sakura_relay_commit_cb (VteTerminal *vte, gchar *text, guint size, gpointer data)
+{
+	struct sakura_relay *relay = (struct sakura_relay *) data;
+
+	sakura_record_event(relay->sk_tab, 'i', text, size);
+	sakura_relay_write(relay, text, size);
+}
+
+
+/* Keep the pty size in sync with the terminal size */
+static void
+sakura_relay_size_allocate_cb (GtkWidget *widget, GdkRectangle *allocation, gpointer data)
+{
+	struct sakura_relay *relay = (struct sakura_relay *) data;
+	glong rows, columns;
+
+	rows = vte_terminal_get_row_count(VTE_TERMINAL(widget));
+	columns = vte_terminal_get_column_count(VTE_TERMINAL(widget));
+
+	if (rows != relay->rows || columns != relay->columns) {
+		relay->rows = rows;
+		relay->columns = columns;
+		vte_pty_set_size(relay->pty, rows, columns, NULL);
+	}
+}
+
+
+/* Feed the child output to the terminal, removing the OSC 52 sequences ("ESC ] 52 ; selection ;
+ * base64 data" ended by BEL or ST). Sequences can be split between reads, so this is a state machine */
+static void
+sakura_relay_output (struct sakura_relay *relay, const char *data, gsize len)
+{
+	VteTerminal *vte = VTE_TERMINAL(relay->sk_tab->vte);
+	const char *p = data, *end = data + len, *start = data, *q;
+	const gsize intro_len = strlen(OSC52_INTRODUCER);
+	gsize n, decoded, old_len;
+
+	sakura_record_event(relay->sk_tab, 'o', data, len);
+
+	while (p < end) {
+		switch (relay->osc52_state) {
+		case OSC52_NONE:
+			/* Nothing to do until the next ESC */
+			if (!(q = memchr(p, '\033', end - p))) {
+				p = end;
+				break;
+			}
+			/* Most of the escape sequences are not OSC 52, don't stop feeding for them */
+			n = MIN(end - q, intro_len);
+			if (memcmp(q, OSC52_INTRODUCER, n) != 0) {
+				p = q + 1;
+				break;
+			}
+			/* OSC 52, or the read ended in the middle of the introducer: keep it */
+			vte_terminal_feed(vte, start, q - start);
+			p = q + n;
+			relay->osc52_intro = n;
+			relay->osc52_state = OSC52_INTRO;
+			if (n == intro_len) {
+				relay->osc52_state = OSC52_SELECTION;
+				relay->osc52_selection_len = 0;
+				relay->osc52_discard = false;
+			}
+			break;
+
+		case OSC52_INTRO:
+			if (*p == OSC52_INTRODUCER[relay->osc52_intro]) {
+				p++;
+				if (++relay->osc52_intro == intro_len) {
+					relay->osc52_state = OSC52_SELECTION;
+					relay->osc52_selection_len = 0;
+					relay->osc52_discard = false;
+				}
+			} else {
+				/* Not OSC 52, the kept introducer chars go to the terminal */
+				vte_terminal_feed(vte, OSC52_INTRODUCER, relay->osc52_intro);
+				relay->osc52_state = OSC52_NONE;
+				start = p;
+			}
+			break;
+
+		case OSC52_SELECTION:
+			if (*p == ';') {
+				relay->osc52_selection[relay->osc52_selection_len] = '\0';
+				relay->osc52_state = OSC52_DATA;
+				relay->osc52_base64_state = 0;
+				relay->osc52_base64_save = 0;
+				g_byte_array_set_size(relay->osc52_data, 0);
+				p++;
+			} else if ((guchar) *p < 0x20) {
+				/* Control chars cancel the sequence */
+				relay->osc52_state = OSC52_NONE;
+				start = p;
+			} else {
+				if (relay->osc52_selection_len < OSC52_SELECTION_MAX) {
+					relay->osc52_selection[relay->osc52_selection_len++] = *p;
+				} else {
+					relay->osc52_discard = true;
+				}
+				p++;
+			}
+			break;
+
+		case OSC52_DATA:
+			/* Decode the payload we have until the terminator */
+			for (q = p; q < end && (guchar) *q >= 0x20; q++);
+			if (q > p) {
+				/* Queries would disclose the clipboard contents. Not supported */
+				if (relay->osc52_data->len == 0 && relay->osc52_base64_state == 0 && *p == '?') {
+					relay->osc52_discard = true;
+				}
+				if (!relay->osc52_discard) {
+					/* Give up as soon as the payload is too big */
+					if (relay->osc52_data->len + (q - p) / 4 * 3 + 3 > sakura.osc52_max_size) {
+						SAY("OSC 52 payload too big, ignored");
+						relay->osc52_discard = true;
+					} else {
+						old_len = relay->osc52_data->len;
+						g_byte_array_set_size(relay->osc52_data, old_len + (q - p) / 4 * 3 + 3);
+						decoded = g_base64_decode_step(p, q - p, relay->osc52_data->data + old_len,
+						                               &relay->osc52_base64_state, &relay->osc52_base64_save);
+						g_byte_array_set_size(relay->osc52_data, old_len + decoded);
+					}
+				}
+				p = q;
+			} else if (*p == '\007') {
+				sakura_osc52_finish(relay);
+				relay->osc52_state = OSC52_NONE;
+				start = ++p;
+			} else if (*p == '\033') {
+				relay->osc52_state = OSC52_DATA_ESC;
+				p++;
+			} else {
+				/* Control chars cancel the sequence */
+				relay->osc52_state = OSC52_NONE;
+				start = p;
+			}
+			break;
+
+		case OSC52_DATA_ESC:
+			if (*p == '\\') {
+				sakura_osc52_finish(relay);
+				relay->osc52_state = OSC52_NONE;
+				start = ++p;
+			} else {
+				/* Not ST, a new escape sequence cancels this one. The ESC is part of it */
+				relay->osc52_state = OSC52_INTRO;
+				relay->osc52_intro = 1;
+			}
+			break;
+		}
+	}
+
+	if (relay->osc52_state == OSC52_NONE && end > start) {
+		vte_terminal_feed(vte, start, end - start);
+	}
+}
+
+
+/* A complete OSC 52 sequence has been read. Set the clipboard when we are back in the main loop */
+static void
+sakura_osc52_finish (struct sakura_relay *relay)
+{
+	struct sakura_clipboard_request *request;
+	const gchar *selection = relay->osc52_selection;
+
+	if (relay->osc52_discard || !relay->sk_tab->osc52)
+		goto done;
+
+	if (!g_utf8_validate((const gchar *) relay->osc52_data->data, relay->osc52_data->len, NULL)) {
+		SAY("OSC 52 payload is not valid UTF-8, ignored");
+		goto done;
+	}
+
+	request = g_new0(struct sakura_clipboard_request, 1);
+	request->text = g_strndup((const gchar *) relay->osc52_data->data, relay->osc52_data->len);
+	request->primary = (strchr(selection, 'p') != NULL);
+	request->clipboard = (strchr(selection, 'c') != NULL || strchr(selection, 's') != NULL || !request->primary);
+	g_idle_add(sakura_osc52_idle_cb, request);
+
+done:
+	/* Don't keep the memory used by big payloads */
+	if (relay->osc52_data->len > RELAY_BUFFER_SIZE) {
+		g_byte_array_free(relay->osc52_data, TRUE);
+		relay->osc52_data = g_byte_array_new();
+	} else {
+		g_byte_array_set_size(relay->osc52_data, 0);
+	}
+}
+
+
+static gboolean
+sakura_osc52_idle_cb (gpointer data)
+{
+	struct sakura_clipboard_request *request = (struct sakura_clipboard_request *) data;
+
+	if (request->clipboard)
+		gtk_clipboard_set_text(gtk_clipboard_get(GDK_SELECTION_CLIPBOARD), request->text, -1);
+	if (request->primary)
+		gtk_clipboard_set_text(gtk_clipboard_get(GDK_SELECTION_PRIMARY), request->text, -1);
+
+	g_free(request->text);
+	g_free(request);
+
+	return G_SOURCE_REMOVE;
+}
+
+
+/* The tab is being closed. Closing the pty hangs up the child, which is reaped by the child watch */
+static void
+sakura_relay_detach (struct sakura_relay *relay)
+{
+	if (relay->read_id) g_source_remove(relay->read_id);
+	if (relay->write_id) g_source_remove(relay->write_id);
+	relay->read_id = relay->write_id = 0;
+
+	g_signal_handlers_disconnect_by_data(relay->sk_tab->vte, relay);
+	relay->sk_tab = NULL;
+	g_clear_object(&relay->pty);
+
+	if (!relay->spawning && !relay->child_watch_id)
+		sakura_relay_free(relay);
+}
+
+
+static void
+sakura_relay_free (struct sakura_relay *relay)
+{
+	g_clear_object(&relay->pty);
+	g_byte_array_free(relay->pending, TRUE);
+	g_byte_array_free(relay->osc52_data, TRUE);
+	g_free(relay);
+}
+
+
+/* Tabs without child show what is fed to them. They don't take input, unless they get an output stream */
+static struct sakura_feed *
+sakura_feed_new (struct sakura_tab *sk_tab)
+{
+	struct sakura_feed *feed;
+
+	feed = g_new0(struct sakura_feed, 1);
+	feed->sk_tab = sk_tab;
+	feed->cancellable = g_cancellable_new();
+	feed->converted = g_byte_array_sized_new(FEED_BUFFER_SIZE);
+	feed->pending = g_byte_array_new();
+	feed->fd = -1;
+	sk_tab->feed = feed;
+
+	vte_terminal_set_input_enabled(VTE_TERMINAL(sk_tab->vte), FALSE);
+
+	return feed;
+}
+
+
+/* Show the contents of a stream in a tab without child */
+static void
+sakura_feed_stream (struct sakura_tab *sk_tab, GInputStream *stream)
+{
+	struct sakura_feed *feed;
+
+	feed = sakura_feed_new(sk_tab);
+	sakura_feed_start(feed, stream, NULL);
+}
+
+
+/* Start reading the input stream. If there's an output stream, the tab takes input and writes it there */
+static void
+sakura_feed_start (struct sakura_feed *feed, GInputStream *stream, GOutputStream *output)
+{
+	feed->stream = g_object_ref(stream);
+
+	if (output) {
+		feed->output = g_object_ref(output);
+		vte_terminal_set_input_enabled(VTE_TERMINAL(feed->sk_tab->vte), TRUE);
+		g_signal_connect(G_OBJECT(feed->sk_tab->vte), "commit", G_CALLBACK(sakura_feed_commit_cb), feed);
+	}
+
+	feed->reading = true;
+	g_input_stream_read_bytes_async(stream, FEED_BUFFER_SIZE, G_PRIORITY_LOW, feed->cancellable,
+	                                sakura_feed_read_cb, feed);
+}
+
+
+/* Read at low priority, so a fast writer doesn't starve the drawing */
+static void
+sakura_feed_read_cb (GObject *source, GAsyncResult *result, gpointer data)
+{
+	struct sakura_feed *feed = (struct sakura_feed *) data;
+	GError *error = NULL;
+	GBytes *bytes;
+	gsize len;
+	const guint8 *buffer;
+
+	bytes = g_input_stream_read_bytes_finish(G_INPUT_STREAM(source), result, &error);
+	feed->reading = false;
+
+	/* The tab has been closed */
+	if (!feed->sk_tab) {
+		if (bytes) g_bytes_unref(bytes);
+		g_clear_error(&error);
+		if (!feed->writing)
+			sakura_feed_free(feed);
+		return;
+	}
+
+	if (!bytes) {
+		WARN("Error reading the tab input: %s", error->message);
+		g_error_free(error);
+		return;
+	}
+
+	buffer = g_bytes_get_data(bytes, &len);
+	if (len == 0) {
+		SAY("End of the tab input");
+		g_bytes_unref(bytes);
+		return;
+	}
+
+	sakura_feed_output(feed, buffer, len);
+	g_bytes_unref(bytes);
+
+	feed->reading = true;
+	g_input_stream_read_bytes_async(feed->stream, FEED_BUFFER_SIZE, G_PRIORITY_LOW, feed->cancellable,
+	                                sakura_feed_read_cb, feed);
+}
+
+
+static void
+sakura_feed_commit_cb (VteTerminal *vte, gchar *text, guint size, gpointer data)
+{
+	struct sakura_feed *feed = (struct sakura_feed *) data;
+
+	sakura_record_event(feed->sk_tab, 'i', text, size);
+	g_byte_array_append(feed->pending, (const guint8 *) text, size);
+	if (!feed->writing)
+		sakura_feed_write(feed);
+}
+
+
+/* Only one write can be in progress, the input typed meanwhile waits in pending */
+static void
+sakura_feed_write (struct sakura_feed *feed)
+{
+	feed->writing_bytes = g_byte_array_free_to_bytes(feed->pending);
+	feed->pending = g_byte_array_new();
+
+	feed->writing = true;
+	g_output_stream_write_all_async(feed->output, g_bytes_get_data(feed->writing_bytes, NULL),
+	                                g_bytes_get_size(feed->writing_bytes), G_PRIORITY_DEFAULT,
+	                                feed->cancellable, sakura_feed_write_cb, feed);
+}
+
+
+static void
+sakura_feed_write_cb (GObject *source, GAsyncResult *result, gpointer data)
+{
+	struct sakura_feed *feed = (struct sakura_feed *) data;
+	GError *error = NULL;
+
+	g_output_stream_write_all_finish(G_OUTPUT_STREAM(source), result, NULL, &error);
+	g_bytes_unref(feed->writing_bytes);
+	feed->writing_bytes = NULL;
+	feed->writing = false;
+
+	if (!feed->sk_tab) {
+		g_clear_error(&error);
+		if (!feed->reading)
+			sakura_feed_free(feed);
+		return;
+	}
+
+	if (error) {
+		WARN("Error writing the tab input: %s", error->message);
+		g_error_free(error);
+		sakura_paste_stop(feed->sk_tab);
+		return;
+	}
+
+	if (feed->pending->len > 0) {
+		sakura_feed_write(feed);
+	} else if (feed->sk_tab->paste) {
+		sakura_paste_schedule(feed->sk_tab->paste);
+	}
+}
+
+
+/* There's no tty adding carriage returns to the newlines, add them ourselves */
+static void
+sakura_feed_output (struct sakura_feed *feed, const guint8 *buffer, gsize len)
+{
+	const guint8 *p, *end = buffer + len;
+
+	/* The output may change the selection we are offering as CLIPBOARD */
+	if (feed->sk_tab->vte == sakura.clipboard_vte) {
+		sakura_clipboard_fetch();
+	}
+
+	if (feed->raw) {
+		sakura_record_event(feed->sk_tab, 'o', (const char *) buffer, len);
+		vte_terminal_feed(VTE_TERMINAL(feed->sk_tab->vte), (const char *) buffer, len);
+		return;
+	}
+
+	g_byte_array_set_size(feed->converted, 0);
+
+	while (buffer < end) {
+		p = memchr(buffer, '\n', end - buffer);
+		if (!p) {
+			g_byte_array_append(feed->converted, buffer, end - buffer);
+			feed->cr = (end[-1] == '\r');
+			break;
+		}
+		g_byte_array_append(feed->converted, buffer, p - buffer);
+		if (!(p > buffer ? p[-1] == '\r' : feed->cr))
+			g_byte_array_append(feed->converted, (const guint8 *) "\r", 1);
+		g_byte_array_append(feed->converted, p, 1);
+		feed->cr = false;
+		buffer = p + 1;
+	}
+
+	sakura_record_event(feed->sk_tab, 'o', (const char *) feed->converted->data, feed->converted->len);
+	vte_terminal_feed(VTE_TERMINAL(feed->sk_tab->vte), (const char *) feed->converted->data, feed->converted->len);
+}
+
+
+/* Follow a file in a new tab, like tail -F: show the last lines and then what is appended,
+ * following the file if it's truncated or rotated. No process or pty is needed */
+static void
+sakura_tail_file (const gchar *path)
+{
+	struct sakura_tab *sk_tab;
+	struct sakura_feed *feed;
+	GFile *file;
+	GError *error = NULL;
+	gchar *basename;
+	gint page;
+
+	sk_tab = sakura_new_tab(false);
+	feed = sakura_feed_new(sk_tab);
+	feed->path = g_strdup(path);
+
+	basename = g_path_get_basename(path);
+	page = gtk_notebook_get_current_page(GTK_NOTEBOOK(sakura.notebook));
+	sakura_set_tab_label_text(basename, page);
+	sk_tab->label_set_byuser = true;
+	g_free(basename);
+
+	/* The monitor watches the directory, so it also tells us when the file is created or replaced */
+	file = g_file_new_for_path(path);
+	feed->monitor = g_file_monitor_file(file, G_FILE_MONITOR_NONE, feed->cancellable, &error);
+	g_object_unref(file);
+	if (feed->monitor) {
+		g_signal_connect(G_OBJECT(feed->monitor), "changed", G_CALLBACK(sakura_tail_changed_cb), feed);
+	} else {
+		sakura_error("Couldn't follow \"%s\": %s", path, error->message);
+		g_error_free(error);
+	}
+
+	/* The file could not exist yet. It will be shown from the start when it's created */
+	if (sakura_tail_open(feed, true)) {
+		sakura_tail_read(feed);
+	}
+}
+
+
+static bool
+sakura_tail_open (struct sakura_feed *feed, bool last_lines)
+{
+	struct stat st;
+
+	feed->fd = open(feed->path, O_RDONLY|O_CLOEXEC);
+	if (feed->fd < 0)
+		return false;
+
+	if (fstat(feed->fd, &st) < 0) {
+		close(feed->fd);
+		feed->fd = -1;
+		return false;
+	}
+
+	feed->dev = st.st_dev;
+	feed->ino = st.st_ino;
+	feed->offset = last_lines ? sakura_tail_start(feed->fd, st.st_size, sakura.tail_lines) : 0;
+
+	return true;
+}
+
+
+/* Find where the last lines of the file start, reading it backwards */
+static goffset
+sakura_tail_start (gint fd, goffset size, gint lines)
+{
+	gchar buffer[4096];
+	goffset pos = size;
+	gint count = 0;
+	ssize_t len, i;
+
+	if (lines <= 0)
+		return size;
+
+	while (pos > 0) {
+		len = MIN((goffset) sizeof(buffer), pos);
+		pos -= len;
+		/* On errors show nothing old, instead of the whole file */
+		if (pread(fd, buffer, len, pos) != len)
+			return size;
+		for (i = len - 1; i >= 0; i--) {
+			/* The newline ending the last line doesn't count */
+			if (buffer[i] == '\n' && pos + i != size - 1 && ++count == lines)
+				return pos + i + 1;
+		}
+	}
+
+	return 0;
+}
+
+
+/* Feed what has been appended since the last read. Big ranges are fed in several main loop iterations */
+static void
+sakura_tail_read (struct sakura_feed *feed)
+{
+	struct stat st;
+	guint8 *buffer;
+	ssize_t len;
+	gsize total = 0;
+	bool rotated;
+
+	if (feed->fd < 0 && !sakura_tail_open(feed, false))
+		return;
+
+	/* Replaced by a new file: feed what is left of the old one, and then follow the new one */
+	rotated = stat(feed->path, &st) == 0 && (st.st_dev != feed->dev || st.st_ino != feed->ino);
+
+	/* Truncated: start again from the beginning */
+	if (fstat(feed->fd, &st) == 0 && st.st_size < feed->offset) {
+		feed->offset = 0;
+	}
+
+	buffer = g_malloc(FEED_BUFFER_SIZE);
+	while (total < TAIL_READ_MAX && (len = pread(feed->fd, buffer, FEED_BUFFER_SIZE, feed->offset)) > 0) {
+		sakura_feed_output(feed, buffer, len);
+		feed->offset += len;
+		total += len;
+	}
+	g_free(buffer);
+
+	if (total >= TAIL_READ_MAX) {
+		if (!feed->idle_id)
+			feed->idle_id = g_idle_add_full(G_PRIORITY_LOW, sakura_tail_idle_cb, feed, NULL);
+		return;
+	}
+
+	if (rotated) {
+		close(feed->fd);
+		feed->fd = -1;
+		if (sakura_tail_open(feed, false))
+			sakura_tail_read(feed);
+	}
+}
+
+
+static void
+sakura_tail_changed_cb (GFileMonitor *monitor, GFile *file, GFile *other_file, GFileMonitorEvent event, gpointer data)
+{
+	struct sakura_feed *feed = (struct sakura_feed *) data;
+
+	switch (event) {
+		case G_FILE_MONITOR_EVENT_CHANGED:
+		case G_FILE_MONITOR_EVENT_CREATED:
+		case G_FILE_MONITOR_EVENT_DELETED:
+			sakura_tail_read(feed);
+			break;
+		default:
+			break;
+	}
+}
+
+
+static gboolean
+sakura_tail_idle_cb (gpointer data)
+{
+	struct sakura_feed *feed = (struct sakura_feed *) data;
+
+	feed->idle_id = 0;
+	sakura_tail_read(feed);
+
+	return G_SOURCE_REMOVE;
+}
+
+
+/* Attach a new tab to a serial device, given as DEVICE[,BAUDS]. The tab reads and writes the
+ * device directly, without running a program like picocom */
+static void
+sakura_serial_tab (const gchar *spec)
+{
+	struct sakura_tab *sk_tab;
+	struct sakura_feed *feed;
+	struct termios tio;
+	gchar **fields, *basename;
+	gint fd, bauds, page;
+	GInputStream *input;
+	GOutputStream *output;
+
+	fields = g_strsplit(spec, ",", 2);
+	bauds = fields[1] ? atoi(fields[1]) : DEFAULT_SERIAL_BAUDS;
+
+	if (sakura_bauds_to_speed(bauds) == B0) {
+		sakura_error("Unsupported serial speed %d", bauds);
+		g_strfreev(fields);
+		return;
+	}
+
+	fd = open(fields[0], O_RDWR|O_NOCTTY|O_NONBLOCK|O_CLOEXEC);
+	if (fd < 0) {
+		sakura_error("Couldn't open \"%s\": %s", fields[0], g_strerror(errno));
+		g_strfreev(fields);
+		return;
+	}
+
+	/* Raw mode: the line discipline and the echo are done at the other side */
+	if (tcgetattr(fd, &tio) == 0) {
+		cfmakeraw(&tio);
+		tio.c_cflag |= CLOCAL | CREAD;
+		cfsetispeed(&tio, sakura_bauds_to_speed(bauds));
+		cfsetospeed(&tio, sakura_bauds_to_speed(bauds));
+		if (tcsetattr(fd, TCSANOW, &tio) < 0) {
+			sakura_error("Couldn't configure \"%s\": %s", fields[0], g_strerror(errno));
+		}
+	}
+
+	sk_tab = sakura_new_tab(false);
+	feed = sakura_feed_new(sk_tab);
+	feed->raw = true;
+
+	basename = g_path_get_basename(fields[0]);
+	page = gtk_notebook_get_current_page(GTK_NOTEBOOK(sakura.notebook));
+	sakura_set_tab_label_text(basename, page);
+	sk_tab->label_set_byuser = true;
+	g_free(basename);
+
+	/* The input stream closes the fd */
+	input = g_unix_input_stream_new(fd, TRUE);
+	output = g_unix_output_stream_new(fd, FALSE);
+	sakura_feed_start(feed, input, output);
+	g_object_unref(input);
+	g_object_unref(output);
+
+	g_strfreev(fields);
+}
+
+
+static speed_t
+sakura_bauds_to_speed (gint bauds)
+{
+	switch (bauds) {
+		case 1200: return B1200;
+		case 2400: return B2400;
+		case 4800: return B4800;
+		case 9600: return B9600;
+		case 19200: return B19200;
+		case 38400: return B38400;
+		case 57600: return B57600;
+		case 115200: return B115200;
+		case 230400: return B230400;
+#ifdef B460800
+		case 460800: return B460800;
+#endif
+#ifdef B921600
+		case 921600: return B921600;
+#endif
+		default: return B0;
+	}
+}
+
+
+/* Attach a new tab to a socket, given as unix:PATH or tcp:HOST:PORT. The tab is created now
+ * and the streams are attached when the connection is done */
+static void
+sakura_socket_tab (const gchar *address)
+{
+	struct sakura_tab *sk_tab;
+	struct sakura_feed *feed;
+	GSocketConnectable *connectable;
+	GSocketClient *client;
+	GError *error = NULL;
+	gint page;
+
+	if (g_str_has_prefix(address, "unix:")) {
+		connectable = G_SOCKET_CONNECTABLE(g_unix_socket_address_new(address + strlen("unix:")));
+	} else if (g_str_has_prefix(address, "tcp:")) {
+		connectable = g_network_address_parse(address + strlen("tcp:"), 0, &error);
+		if (!connectable) {
+			sakura_error("Invalid address \"%s\": %s", address, error->message);
+			g_error_free(error);
+			return;
+		}
+	} else {
+		sakura_error("Invalid address \"%s\", use unix:PATH or tcp:HOST:PORT", address);
+		return;
+	}
+
+	sk_tab = sakura_new_tab(false);
+	feed = sakura_feed_new(sk_tab);
+	feed->raw = true;
+
+	page = gtk_notebook_get_current_page(GTK_NOTEBOOK(sakura.notebook));
+	sakura_set_tab_label_text(address, page);
+	sk_tab->label_set_byuser = true;
+
+	/* Connecting counts as reading: the callback needs the feed */
+	client = g_socket_client_new();
+	feed->reading = true;
+	g_socket_client_connect_async(client, connectable, feed->cancellable, sakura_socket_connected_cb, feed);
+	g_object_unref(client);
+	g_object_unref(connectable);
+}
+
+
+static void
+sakura_socket_connected_cb (GObject *source, GAsyncResult *result, gpointer data)
+{
+	struct sakura_feed *feed = (struct sakura_feed *) data;
+	GSocketConnection *connection;
+	GError *error = NULL;
+
+	connection = g_socket_client_connect_finish(G_SOCKET_CLIENT(source), result, &error);
+	feed->reading = false;
+
+	if (!feed->sk_tab) {
+		g_clear_object(&connection);
+		g_clear_error(&error);
+		sakura_feed_free(feed);
+		return;
+	}
+
+	if (!connection) {
+		sakura_error("Couldn't connect: %s", error->message);
+		g_error_free(error);
+		return;
+	}
+
+	feed->connection = G_IO_STREAM(connection);
+	sakura_feed_start(feed, g_io_stream_get_input_stream(feed->connection),
+	                  g_io_stream_get_output_stream(feed->connection));
+}
+
+
+/* Record the tab output, input and size changes to $XDG_DATA_HOME/sakura/recordings */
+static void
+sakura_record_start (struct sakura_tab *sk_tab)
+{
+	struct sakura_recorder *recorder;
+	GDateTime *now;
+	gchar *date;
+	static guint count = 0;
+
+	if (sk_tab->recorder)
+		return;
+
+	recorder = g_new0(struct sakura_recorder, 1);
+	recorder->ring = g_malloc(RECORDER_RING_SIZE);
+	g_mutex_init(&recorder->mutex);
+	g_cond_init(&recorder->cond);
+	recorder->gzip = sakura.recording_gzip;
+	recorder->columns = vte_terminal_get_column_count(VTE_TERMINAL(sk_tab->vte));
+	recorder->rows = vte_terminal_get_row_count(VTE_TERMINAL(sk_tab->vte));
+	recorder->last_columns = recorder->columns;
+	recorder->last_rows = recorder->rows;
+	recorder->term = g_strdup(sakura.term ? sakura.term : "xterm-256color");
+	recorder->start = g_get_monotonic_time();
+	recorder->timestamp = g_get_real_time() / G_USEC_PER_SEC;
+
+	now = g_date_time_new_now_local();
+	date = g_date_time_format(now, "%Y%m%d-%H%M%S");
+	recorder->dir = g_build_filename(g_get_user_data_dir(), "sakura", "recordings", NULL);
+	recorder->filename = g_strdup_printf("%s-%d-%u.cast%s", date, getpid(), ++count, recorder->gzip ? ".gz" : "");
+	g_free(date);
+	g_date_time_unref(now);
+
+	if (!sakura.recorders)
+		sakura.recorders = g_ptr_array_new();
+	g_ptr_array_add(sakura.recorders, recorder);
+
+	/* Even creating the file is done by the thread, the main loop never waits for the disk */
+	recorder->thread = g_thread_new("sakura-recorder", sakura_recorder_thread, recorder);
+	sk_tab->recorder = recorder;
+}
+
+
+/* Tell the writer thread to finish. It will be joined when it's done */
+static void
+sakura_record_stop (struct sakura_tab *sk_tab)
+{
+	struct sakura_recorder *recorder = sk_tab->recorder;
+
+	if (!recorder)
+		return;
+
+	sk_tab->recorder = NULL;
+
+	if (recorder->dropped) {
+		WARN("Recording %s: %u events dropped", recorder->filename, recorder->dropped);
+	}
+
+	g_atomic_int_set(&recorder->stopping, 1);
+	g_mutex_lock(&recorder->mutex);
+	g_cond_signal(&recorder->cond);
+	g_mutex_unlock(&recorder->mutex);
+}
+
+
+/* Record the size changes of all the tabs, with a child or fed */
+static void
+sakura_record_size_allocate_cb (GtkWidget *widget, GdkRectangle *allocation, gpointer data)
+{
+	struct sakura_tab *sk_tab = (struct sakura_tab *) data;
+	struct sakura_recorder *recorder = sk_tab->recorder;
+	glong rows, columns;
+	gchar *size;
+
+	if (!recorder)
+		return;
+
+	rows = vte_terminal_get_row_count(VTE_TERMINAL(widget));
+	columns = vte_terminal_get_column_count(VTE_TERMINAL(widget));
+	if (rows == recorder->last_rows && columns == recorder->last_columns)
+		return;
+
+	recorder->last_rows = rows;
+	recorder->last_columns = columns;
+	size = g_strdup_printf("%ldx%ld", columns, rows);
+	sakura_record_event(sk_tab, 'r', size, strlen(size));
+	g_free(size);
+}
+
+
+/* Called from the main thread for every event. Never blocks: if the ring is full, the event is dropped */
+static void
+sakura_record_event (struct sakura_tab *sk_tab, gchar type, const char *data, gsize len)
+{
+	struct sakura_recorder *recorder = sk_tab->recorder;
+	struct sakura_record_header header;
+	guint head, tail;
+	gsize size = sizeof(header) + len;
+
+	if (!recorder)
+		return;
+
+	head = (guint) recorder->head;
+	tail = (guint) g_atomic_int_get(&recorder->tail);
+	if (size > RECORDER_RING_SIZE - (head - tail)) {
+		recorder->dropped++;
+		return;
+	}
+
+	header.time = g_get_monotonic_time() - recorder->start;
+	header.len = len;
+	header.type = type;
+	sakura_ring_put(recorder, head, &header, sizeof(header));
+	sakura_ring_put(recorder, head + sizeof(header), data, len);
+	g_atomic_int_set(&recorder->head, (gint) (head + size));
+
+	/* Only take the lock when the writer thread is waiting, it's never held while writing */
+	if (g_atomic_int_get(&recorder->sleeping)) {
+		g_mutex_lock(&recorder->mutex);
+		g_cond_signal(&recorder->cond);
+		g_mutex_unlock(&recorder->mutex);
+	}
+}
+
+
+static void
+sakura_ring_put (struct sakura_recorder *recorder, guint pos, const void *data, gsize len)
+{
+	gsize offset = pos & (RECORDER_RING_SIZE - 1);
+	gsize first = MIN(len, RECORDER_RING_SIZE - offset);
+
+	memcpy(recorder->ring + offset, data, first);
+	memcpy(recorder->ring, (const guint8 *) data + first, len - first);
+}
+
+
+static void
+sakura_ring_get (struct sakura_recorder *recorder, guint pos, void *data, gsize len)
+{
+	gsize offset = pos & (RECORDER_RING_SIZE - 1);
+	gsize first = MIN(len, RECORDER_RING_SIZE - offset);
+
+	memcpy(data, recorder->ring + offset, first);
+	memcpy((guint8 *) data + first, recorder->ring, len - first);
+}
+
+
+/* Writer thread: takes the events from the ring and writes them as asciicast lines */
+static gpointer
+sakura_recorder_thread (gpointer data)
+{
+	struct sakura_recorder *recorder = (struct sakura_recorder *) data;
+	struct sakura_record_header header;
+	GOutputStream *output = NULL, *stream;
+	GFileOutputStream *file_stream;
+	GZlibCompressor *compressor;
+	GFile *file;
+	GError *error = NULL;
+	GByteArray *event, *carry[3];
+	GString *line;
+	gchar *path;
+	guint head, tail;
+	bool stop;
+
+	path = g_build_filename(recorder->dir, recorder->filename, NULL);
+	file = g_file_new_for_path(path);
+	file_stream = NULL;
+	if (g_mkdir_with_parents(recorder->dir, 0700) == 0) {
+		file_stream = g_file_replace(file, NULL, FALSE, G_FILE_CREATE_PRIVATE, NULL, &error);
+	}
+	if (file_stream) {
+		stream = G_OUTPUT_STREAM(file_stream);
+		if (recorder->gzip) {
+			compressor = g_zlib_compressor_new(G_ZLIB_COMPRESSOR_FORMAT_GZIP, -1);
+			stream = g_converter_output_stream_new(stream, G_CONVERTER(compressor));
+			g_object_unref(compressor);
+			g_object_unref(file_stream);
+		}
+		output = g_buffered_output_stream_new_sized(stream, RECORDER_BUFFER_SIZE);
+		g_object_unref(stream);
+	} else {
+		recorder->error = g_strdup_printf("Couldn't record to \"%s\": %s", path,
+		                                  error ? error->message : g_strerror(errno));
+		g_clear_error(&error);
+	}
+	g_object_unref(file);
+	g_free(path);
+
+	line = g_string_new(NULL);
+	event = g_byte_array_new();
+	carry[0] = g_byte_array_new();
+	carry[1] = g_byte_array_new();
+	carry[2] = g_byte_array_new();
+
+	g_string_printf(line, "{\"version\": 2, \"width\": %ld, \"height\": %ld, \"timestamp\": %" G_GINT64_FORMAT ", "
+	                "\"env\": {\"TERM\": \"%s\"}}\n", recorder->columns, recorder->rows, recorder->timestamp, recorder->term);
+	if (output)
+		g_output_stream_write_all(output, line->str, line->len, NULL, NULL, NULL);
+
+	while (true) {
+		tail = (guint) recorder->tail;
+		head = (guint) g_atomic_int_get(&recorder->head);
+
+		if (head == tail) {
+			/* Nothing else to write for now: flush, and sleep until there are events or we're done */
+			if (output)
+				g_output_stream_flush(output, NULL, NULL);
+			g_mutex_lock(&recorder->mutex);
+			g_atomic_int_set(&recorder->sleeping, 1);
+			while ((guint) g_atomic_int_get(&recorder->head) == tail && !g_atomic_int_get(&recorder->stopping))
+				g_cond_wait(&recorder->cond, &recorder->mutex);
+			g_atomic_int_set(&recorder->sleeping, 0);
+			stop = (guint) g_atomic_int_get(&recorder->head) == tail;
+			g_mutex_unlock(&recorder->mutex);
+			if (stop)
+				break;
+			continue;
+		}
+
+		sakura_ring_get(recorder, tail, &header, sizeof(header));
+		g_byte_array_set_size(event, header.len);
+		sakura_ring_get(recorder, tail + sizeof(header), event->data, header.len);
+		g_atomic_int_set(&recorder->tail, (gint) (tail + sizeof(header) + header.len));
+
+		if (!output)
+			continue;
+
+		g_string_printf(line, "[%" G_GINT64_FORMAT ".%06" G_GINT64_FORMAT ", \"%c\", \"",
+		                header.time / G_USEC_PER_SEC, header.time % G_USEC_PER_SEC, header.type);
+		sakura_recorder_escape(line, carry[header.type == 'o' ? 0 : header.type == 'i' ? 1 : 2], event->data, event->len);
+		g_string_append(line, "\"]\n");
+
+		if (!g_output_stream_write_all(output, line->str, line->len, NULL, NULL, &error)) {
+			recorder->error = g_strdup_printf("Couldn't write the recording: %s", error->message);
+			g_clear_error(&error);
+			g_clear_object(&output);
+		}
+	}
+
+	if (output) {
+		g_output_stream_close(output, NULL, NULL);
+		g_object_unref(output);
+	}
+	g_string_free(line, TRUE);
+	g_byte_array_free(event, TRUE);
+	g_byte_array_free(carry[0], TRUE);
+	g_byte_array_free(carry[1], TRUE);
+	g_byte_array_free(carry[2], TRUE);
+
+	g_idle_add(sakura_recorder_reap_cb, recorder);
+
+	return NULL;
+}
+
+
+/* JSON string escaping. Reads can end in the middle of a UTF-8 character, keep it in carry for the
+ * next event of the same type. Invalid UTF-8 is replaced */
+static void
+sakura_recorder_escape (GString *line, GByteArray *carry, const guint8 *data, gsize len)
+{
+	const guint8 *p, *end;
+	gunichar c;
+
+	if (carry->len > 0) {
+		g_byte_array_append(carry, data, len);
+		data = carry->data;
+		len = carry->len;
+	}
+
+	p = data;
+	end = data + len;
+	while (p < end) {
+		if (*p < 0x80) {
+			if (*p == '"' || *p == '\\') {
+				g_string_append_c(line, '\\');
+				g_string_append_c(line, *p);
+			} else if (*p < 0x20 || *p == 0x7f) {
+				g_string_append_printf(line, "\\u%04x", *p);
+			} else {
+				g_string_append_c(line, *p);
+			}
+			p++;
+			continue;
+		}
+
+		c = g_utf8_get_char_validated((const gchar *) p, end - p);
+		if (c == (gunichar) -2) {
+			break;
+		} else if (c == (gunichar) -1) {
+			g_string_append(line, "\\ufffd");
+			p++;
+		} else {
+			g_string_append_len(line, (const gchar *) p, g_utf8_skip[*p]);
+			p += g_utf8_skip[*p];
+		}
+	}
+
+	/* Keep the incomplete character, if any */
+	if (data == carry->data) {
+		g_byte_array_remove_range(carry, 0, p - data);
+	} else {
+		g_byte_array_append(carry, p, end - p);
+	}
+}
+
+
+/* The writer thread is done */
+static gboolean
+sakura_recorder_reap_cb (gpointer data)
+{
+	struct sakura_recorder *recorder = (struct sakura_recorder *) data;
+
+	g_ptr_array_remove(sakura.recorders, recorder);
+	if (recorder->error) {
+		sakura_error("%s", recorder->error);
+	}
+	sakura_recorder_free(recorder);
+
+	return G_SOURCE_REMOVE;
+}
+
+
+static void
+sakura_recorder_free (struct sakura_recorder *recorder)
+{
+	g_thread_join(recorder->thread);
+	g_mutex_clear(&recorder->mutex);
+	g_cond_clear(&recorder->cond);
+	g_free(recorder->ring);
+	g_free(recorder->dir);
+	g_free(recorder->filename);
+	g_free(recorder->term);
+	g_free(recorder->error);
+	g_free(recorder);
+}
+
+
+/* At exit, wait for the writer threads that haven't finished yet */
+static void
+sakura_recorders_wait ()
+{
+	struct sakura_recorder *recorder;
+
+	while (sakura.recorders && sakura.recorders->len > 0) {
+		recorder = g_ptr_array_index(sakura.recorders, 0);
+		g_ptr_array_remove_index(sakura.recorders, 0);
+		if (recorder->error) {
+			fprintf(stderr, "%s\n", recorder->error);
+		}
+		sakura_recorder_free(recorder);
+	}
+}
+
+
+/* $XDG_STATE_HOME/sakura, for the logs. Created if needed */
+static gchar *
+sakura_state_dir (void)
+{
+	const gchar *state_dir;
+	gchar *dir;
+
+#if GLIB_CHECK_VERSION(2, 72, 0)
+	state_dir = g_get_user_state_dir();
+	dir = g_build_filename(state_dir, "sakura", NULL);
+#else
+	state_dir = g_getenv("XDG_STATE_HOME");
+	if (state_dir && g_path_is_absolute(state_dir)) {
+		dir = g_build_filename(state_dir, "sakura", NULL);
+	} else {
+		dir = g_build_filename(g_get_home_dir(), ".local", "state", "sakura", NULL);
+	}
+#endif
+	if (g_mkdir_with_parents(dir, 0700) != 0) {
+		WARN("Cannot create %s: %s", dir, g_strerror(errno));
+	}
+
+	return dir;
+}
+
+
+/* Start the stall watchdog. Stalls are logged to $XDG_STATE_HOME/sakura/stalls.log */
+static void
+sakura_watchdog_start (gint threshold)
+{
+	struct sakura_watchdog *watchdog;
+	struct sigaction action;
+	gchar *dir;
+
+	watchdog = g_new0(struct sakura_watchdog, 1);
+	watchdog->threshold = threshold;
+	watchdog->main_thread = pthread_self();
+	sem_init(&watchdog->captured, 0, 0);
+
+	dir = sakura_state_dir();
+	watchdog->log = g_build_filename(dir, "stalls.log", NULL);
+	g_free(dir);
+
+#ifdef HAVE_EXECINFO_H
+	/* The first call loads libgcc, it can't be done inside the signal handler */
+	watchdog->nframes = backtrace(watchdog->frames, WATCHDOG_MAX_FRAMES);
+#endif
+
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = sakura_watchdog_signal;
+	action.sa_flags = SA_RESTART;
+	sigemptyset(&action.sa_mask);
+	sigaction(WATCHDOG_SIGNAL, &action, NULL);
+
+	sakura.watchdog = watchdog;
+	g_atomic_int_set(&watchdog->pet, sakura_watchdog_now());
+
+	/* Pet a few times per threshold. High priority, so only a blocked main loop misses it */
+	watchdog->timeout_id = g_timeout_add_full(G_PRIORITY_HIGH, MAX(threshold / 4, 10), sakura_watchdog_pet_cb, watchdog, NULL);
+	g_source_set_name_by_id(watchdog->timeout_id, "sakura watchdog");
+
+	watchdog->thread = g_thread_new("sakura watchdog", sakura_watchdog_thread, watchdog);
+}
+
+
+static guint
+sakura_watchdog_now (void)
+{
+	return (guint) ((g_get_monotonic_time() - sakura.startup_time) / 1000);
+}
+
+
+static gboolean
+sakura_watchdog_pet_cb (gpointer data)
+{
+	struct sakura_watchdog *watchdog = (struct sakura_watchdog *) data;
+
+	g_atomic_int_set(&watchdog->depth, g_main_depth());
+	g_atomic_int_set(&watchdog->pet, sakura_watchdog_now());
+
+	return G_SOURCE_CONTINUE;
+}
+
+
+/* Runs in the main thread, interrupted by the watchdog. Only async-signal-safe work here,
+ * so no GLib calls: the running handler is kept by the closure guards, and the main loop
+ * depth by the pet callback (backtrace was already loaded at start) */
+static void
+sakura_watchdog_signal (int signum)
+{
+	struct sakura_watchdog *watchdog = sakura.watchdog;
+	int saved_errno = errno;
+
+	watchdog->callback = callback_current;
+
+#ifdef HAVE_EXECINFO_H
+	watchdog->nframes = backtrace(watchdog->frames, WATCHDOG_MAX_FRAMES);
+#else
+	watchdog->nframes = 0;
+#endif
+
+	sem_post(&watchdog->captured);
+	errno = saved_errno;
+}
+
+
+static gpointer
+sakura_watchdog_thread (gpointer data)
+{
+	struct sakura_watchdog *watchdog = (struct sakura_watchdog *) data;
+	struct timespec deadline;
+	guint pet, now, stall_pet = 0;
+	bool stalled = false, captured;
+
+	while (true) {
+		g_usleep((gulong) MAX(watchdog->threshold / 4, 10) * 1000);
+
+		pet = g_atomic_int_get(&watchdog->pet);
+		now = sakura_watchdog_now();
+
+		if (!stalled && now - pet > (guint) watchdog->threshold) {
+			stalled = true;
+			stall_pet = pet;
+
+			/* Ask the main thread for its stack, it may take a moment to be scheduled.
+			 * A late answer to the previous stall is discarded first */
+			while (sem_trywait(&watchdog->captured) == 0);
+			pthread_kill(watchdog->main_thread, WATCHDOG_SIGNAL);
+			clock_gettime(CLOCK_REALTIME, &deadline);
+			deadline.tv_sec += 1;
+			do {
+				captured = (sem_timedwait(&watchdog->captured, &deadline) == 0);
+			} while (!captured && errno == EINTR);
+
+			sakura_trace(TRACE_STALL, now - pet, false);
+			sakura_watchdog_log(watchdog, now - pet, false, captured);
+		} else if (stalled && pet != stall_pet) {
+			stalled = false;
+			sakura_trace(TRACE_STALL, pet - stall_pet, true);
+			sakura_watchdog_log(watchdog, pet - stall_pet, true, false);
+		}
+	}
+
+	return NULL;
+}
+
+
+/* Append a stall, or the end of the last one, to the log. When the log is too big,
+ * it becomes stalls.log.old and a new one is started */
+static void
+sakura_watchdog_log (struct sakura_watchdog *watchdog, guint elapsed, bool ended, bool captured)
+{
+	GDateTime *now;
+	GStatBuf st;
+	gchar *timestamp, *old;
+	FILE *log;
+
+	if (g_stat(watchdog->log, &st) == 0 && st.st_size > WATCHDOG_LOG_SIZE) {
+		old = g_strconcat(watchdog->log, ".old", NULL);
+		g_rename(watchdog->log, old);
+		g_free(old);
+	}
+
+	if (!(log = g_fopen(watchdog->log, "a"))) {
+		WARN("Cannot open %s: %s", watchdog->log, g_strerror(errno));
+		return;
+	}
+
+	now = g_date_time_new_now_local();
+	timestamp = g_date_time_format(now, "%F %T");
+	g_date_time_unref(now);
+
+	if (ended) {
+		fprintf(log, "%s [%d] main loop stalled for %u ms\n\n", timestamp, getpid(), elapsed);
+	} else if (!captured) {
+		fprintf(log, "%s [%d] main loop blocked for more than %u ms, no stack captured\n", timestamp, getpid(), elapsed);
+	} else {
+		fprintf(log, "%s [%d] main loop blocked for more than %u ms in %s, main loop depth %d\n",
+		        timestamp, getpid(), elapsed, watchdog->callback ? watchdog->callback : "no signal handler",
+		        g_atomic_int_get(&watchdog->depth));
+		fflush(log);
+#ifdef HAVE_EXECINFO_H
+		backtrace_symbols_fd(watchdog->frames, watchdog->nframes, fileno(log));
+#endif
+	}
+
+	fclose(log);
+	g_free(timestamp);
+}
+
+
+static void
+sakura_open_log_dialog ()
+{
+	GtkWidget *file_dialog;
+	gint response;
+	gchar *filename;
+
+	file_dialog = gtk_file_chooser_dialog_new(_("Open log"),
+	                                          GTK_WINDOW(sakura.main_window),
+	                                          GTK_FILE_CHOOSER_ACTION_OPEN,
+	                                          _("_Cancel"), GTK_RESPONSE_CANCEL,
+	                                          _("_Open"), GTK_RESPONSE_ACCEPT,
+	                                          NULL);
+	gtk_dialog_set_default_response(GTK_DIALOG(file_dialog), GTK_RESPONSE_ACCEPT);
+
+	response = gtk_dialog_run(GTK_DIALOG(file_dialog));
+	if (response == GTK_RESPONSE_ACCEPT) {
+		filename = gtk_file_chooser_get_filename(GTK_FILE_CHOOSER(file_dialog));
+		if (filename) {
+			sakura_tail_file(filename);
+			g_free(filename);
 		}
-		gtk_label_set_text(GTK_LABEL(sk_tab->label), chopped_title);
-		free(chopped_title);
-	} else { /* Use the default values */
-		default_label_text = g_strdup_printf(_("Terminal %d"), page);
-		gtk_label_set_text(GTK_LABEL(sk_tab->label), default_label_text);
-		free(default_label_text);
+	}
+	gtk_widget_destroy(file_dialog);
+}
+
+
+static void
+sakura_feed_free (struct sakura_feed *feed)
+{
+	g_clear_object(&feed->stream);
+	g_clear_object(&feed->output);
+	g_clear_object(&feed->connection);
+	g_clear_object(&feed->monitor);
+	g_object_unref(feed->cancellable);
+	g_byte_array_free(feed->converted, TRUE);
+	g_byte_array_free(feed->pending, TRUE);
+	if (feed->fd >= 0)
+		close(feed->fd);
+	g_free(feed->path);
+	g_free(feed);
+}
+
+
+/* Called when the tab is closed. Pending reads or writes still need the feed, so the last one frees it */
+static void
+sakura_feed_stop (struct sakura_tab *sk_tab)
+{
+	struct sakura_feed *feed = sk_tab->feed;
+
+	if (!feed)
+		return;
+
+	sk_tab->feed = NULL;
+	feed->sk_tab = NULL;
+
+	if (feed->monitor) {
+		g_signal_handlers_disconnect_by_func(feed->monitor, sakura_tail_changed_cb, feed);
+		g_file_monitor_cancel(feed->monitor);
+	}
+	if (feed->idle_id)
+		g_source_remove(feed->idle_id);
+
+	if (feed->output) {
+		g_signal_handlers_disconnect_by_func(sk_tab->vte, sakura_feed_commit_cb, feed);
+	}
+
+	if (feed->reading || feed->writing) {
+		g_cancellable_cancel(feed->cancellable);
+	} else {
+		sakura_feed_free(feed);
+	}
+}
+
+
+/* Estimate the memory used by a tab. It's an upper bound for the scrollback, trailing blanks
+ * are not stored and the rows are usually shorter than the terminal */
+static gsize
+sakura_tab_memory (struct sakura_tab *sk_tab, glong *scrollback_rows)
+{
+	GtkAdjustment *adjustment;
+	glong rows, columns, history;
+	gsize memory = MEMORY_TAB_OVERHEAD;
+
+	rows = vte_terminal_get_row_count(VTE_TERMINAL(sk_tab->vte));
+	columns = vte_terminal_get_column_count(VTE_TERMINAL(sk_tab->vte));
+	adjustment = gtk_scrollable_get_vadjustment(GTK_SCROLLABLE(sk_tab->vte));
+	history = (glong) (gtk_adjustment_get_upper(adjustment) - gtk_adjustment_get_lower(adjustment)) - rows;
+	history = MAX(history, 0);
+
+	memory += (gsize) rows * columns * MEMORY_CELL_SIZE;
+	memory += (gsize) history * (columns + MEMORY_SCROLLBACK_ROW_SIZE);
+	if (sk_tab->relay) memory += RELAY_BUFFER_SIZE;
+	if (sk_tab->feed) memory += FEED_BUFFER_SIZE;
+	if (sk_tab->paste) memory += sk_tab->paste->total - MIN(sk_tab->paste->total, sk_tab->paste->written + sk_tab->paste->unread);
+
+	if (scrollback_rows) *scrollback_rows = history;
+
+	return memory;
+}
+
+
+/* Resident and proportional set size of sakura, in KiB */
+static bool
+sakura_process_memory (gsize *rss, gsize *pss)
+{
+	gchar *contents, **lines;
+	int i;
+
+	*rss = *pss = 0;
+
+	if (!g_file_get_contents("/proc/self/smaps_rollup", &contents, NULL, NULL))
+		return false;
+
+	lines = g_strsplit(contents, "\n", -1);
+	for (i = 0; lines[i]; i++) {
+		if (g_str_has_prefix(lines[i], "Rss:"))
+			*rss = g_ascii_strtoull(lines[i] + strlen("Rss:"), NULL, 10);
+		else if (g_str_has_prefix(lines[i], "Pss:"))
+			*pss = g_ascii_strtoull(lines[i] + strlen("Pss:"), NULL, 10);
+	}
+	g_strfreev(lines);
+	g_free(contents);
+
+	return true;
+}
+
+
+static void
+sakura_memory_dump (void)
+{
+	struct sakura_tab *sk_tab;
+	gsize rss, pss, memory, total = 0;
+	gchar *size;
+	glong history;
+	gint page, npages;
+
+	npages = gtk_notebook_get_n_pages(GTK_NOTEBOOK(sakura.notebook));
+	for (page = 0; page < npages; page++) {
+		sk_tab = sakura_get_sktab(sakura, page);
+		memory = sakura_tab_memory(sk_tab, &history);
+		total += memory;
+		size = g_format_size(memory);
+		fprintf(stderr, "memory: tab %d \"%s\": %ldx%ld, %ld scrollback rows, about %s\n", page + 1,
+		        gtk_label_get_text(GTK_LABEL(sk_tab->label)),
+		        vte_terminal_get_column_count(VTE_TERMINAL(sk_tab->vte)),
+		        vte_terminal_get_row_count(VTE_TERMINAL(sk_tab->vte)), history, size);
+		g_free(size);
+	}
+
+	size = g_format_size(total);
+	if (sakura_process_memory(&rss, &pss)) {
+		fprintf(stderr, "memory: %d tabs, about %s. Process RSS %" G_GSIZE_FORMAT " KiB, PSS %" G_GSIZE_FORMAT " KiB\n",
+		        npages, size, rss, pss);
+	} else {
+		fprintf(stderr, "memory: %d tabs, about %s\n", npages, size);
+	}
+	g_free(size);
+}
+
+
+static gboolean
+sakura_dump_cb (gpointer data)
+{
+	sakura_memory_dump();
+#ifdef SAKURA_CALLBACK_STATS
+	sakura_stats_dump();
+#endif
+	if (trace_ring.path) {
+		sakura_trace_dump(0);
+		fprintf(stderr, "trace: written to %s\n", trace_ring.path);
+	}
+
+	return G_SOURCE_CONTINUE;
+}
+
+
+/* Build the dump path and catch the crashes, as early as possible */
+static void
+sakura_trace_init (void)
+{
+	const int signals[] = { SIGSEGV, SIGBUS, SIGILL, SIGFPE, SIGABRT };
+	struct sigaction action;
+	gchar *dir;
+	guint i;
+
+	trace_ring.start = sakura.startup_time;
+
+	dir = sakura_state_dir();
+	trace_ring.path = g_build_filename(dir, "trace.log", NULL);
+	trace_ring.old_path = g_strconcat(trace_ring.path, ".old", NULL);
+	g_free(dir);
+
+	/* One shot, the default action is taken when the handler raises the signal again */
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = sakura_trace_crash_signal;
+	action.sa_flags = SA_RESETHAND;
+	sigemptyset(&action.sa_mask);
+	for (i = 0; i < G_N_ELEMENTS(signals); i++) {
+		sigaction(signals[i], &action, NULL);
 	}
 }
 
 
-/* Callback for vte_terminal_spawn_async */
-void
-sakura_spawn_callback (VteTerminal *vte, GPid pid, GError *error, gpointer user_data)
+static void
+sakura_trace_crash_signal (int signum)
 {
-	struct sakura_tab *sk_tab = (struct sakura_tab *) user_data;
+	sakura_trace_dump(signum);
+	raise(signum);
+}
 
-	if (pid == -1) { /* Fork has failed */
-		SAY("Error: %s", error->message);
+
+/* Append a string, or the number if the string is NULL, right aligned to width.
+ * No stdio here, the dump must be async-signal-safe */
+static gsize
+sakura_trace_append (char *line, gsize len, const char *string, gint64 number, int width)
+{
+	char digits[64];
+	guint64 magnitude;
+	gsize n = 0, i;
+
+	if (string) {
+		while (string[n] && n < sizeof(digits)) {
+			digits[n] = string[n];
+			n++;
+		}
 	} else {
-		sk_tab->pid=pid;
+		magnitude = number < 0 ? -(guint64) number : (guint64) number;
+		do {
+			digits[sizeof(digits) - 1 - n++] = '0' + magnitude % 10;
+			magnitude /= 10;
+		} while (magnitude);
+		if (number < 0)
+			digits[sizeof(digits) - 1 - n++] = '-';
+		memmove(digits, digits + sizeof(digits) - n, n);
+	}
+
+	line[len++] = ' ';
+	for (i = n; (int) i < width; i++)
+		line[len++] = ' ';
+	memcpy(line + len, digits, n);
+
+	return len + n;
+}
+
+
+/* Write the ring, oldest event first, to trace.log. The previous dump is kept as trace.log.old.
+ * Called from the crash handler, so only async-signal-safe calls */
+static void
+sakura_trace_dump (int signum)
+{
+	const struct sakura_trace_entry *entry;
+	char line[512];
+	gsize len;
+	guint next, first, i;
+	int fd;
+
+	if (!trace_ring.path)
+		return;
+
+	sakura_trace(TRACE_DUMP, signum, 0);
+	next = (guint) g_atomic_int_get(&trace_ring.next);
+	first = next > TRACE_RING_SIZE ? next - TRACE_RING_SIZE : 0;
+
+	rename(trace_ring.path, trace_ring.old_path);
+	if ((fd = open(trace_ring.path, O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC, 0600)) == -1)
+		return;
+
+	len = sakura_trace_append(line, 0, "sakura " VERSION ", pid", 0, 0);
+	len = sakura_trace_append(line, len, NULL, getpid(), 0);
+	len = sakura_trace_append(line, len, "signal", 0, 0);
+	len = sakura_trace_append(line, len, NULL, signum, 0);
+	line[len++] = '\n';
+	len = sakura_trace_append(line, len, "time_us", 0, 12);
+	len = sakura_trace_append(line, len, "event", 0, 12);
+	len = sakura_trace_append(line, len, "arg0", 0, 10);
+	len = sakura_trace_append(line, len, "arg1", 0, 10);
+	line[len++] = '\n';
+	if (write(fd, line, len) < 0)
+		goto done;
+
+	for (i = first; i != next; i++) {
+		entry = &trace_ring.entries[i & (TRACE_RING_SIZE - 1)];
+		if (entry->event <= TRACE_NONE || entry->event >= TRACE_EVENTS)
+			continue;
+
+		len = sakura_trace_append(line, 0, NULL, entry->time, 12);
+		len = sakura_trace_append(line, len, trace_event_names[entry->event], 0, 12);
+		len = sakura_trace_append(line, len, NULL, entry->arg0, 10);
+		len = sakura_trace_append(line, len, NULL, entry->arg1, 10);
+		line[len++] = '\n';
+		if (write(fd, line, len) < 0)
+			break;
 	}
+
+done:
+	close(fd);
+}
+
+
+/* The estimate is only computed when the tooltip is shown */
+static gboolean
+sakura_label_query_tooltip_cb (GtkWidget *widget, gint x, gint y, gboolean keyboard_mode, GtkTooltip *tooltip, gpointer data)
+{
+	struct sakura_tab *sk_tab = (struct sakura_tab *) data;
+	gchar *size, *text;
+	glong history;
+
+	size = g_format_size(sakura_tab_memory(sk_tab, &history));
+	text = g_strdup_printf(_("%s\nScrollback: %ld lines\nMemory: about %s"),
+	                       gtk_label_get_text(GTK_LABEL(sk_tab->label)), history, size);
+	gtk_tooltip_set_text(tooltip, text);
+	g_free(text);
+	g_free(size);
+
+	return TRUE;
+}
+
+
+/* Get the pty file descriptor of a tab, -1 if there's no pty */
+static gint
+sakura_tab_get_pty_fd (struct sakura_tab *sk_tab)
+{
+	VtePty *pty;
+
+	pty = sk_tab->relay ? sk_tab->relay->pty : vte_terminal_get_pty(VTE_TERMINAL(sk_tab->vte));
+
+	return pty ? vte_pty_get_fd(pty) : -1;
 }
 
 
 static void
 sakura_add_tab()
+{
+	sakura_new_tab(true);
+}
+
+
+/* Create a new tab, running a shell or the command line command if spawn is true */
+static struct sakura_tab *
+sakura_new_tab(bool spawn)
 {
 	struct sakura_tab *sk_tab;
 	GtkWidget *tab_title_hbox; GtkWidget *close_button; /* We could put them inside struct sakura_tab, but it is not necessary */
 	GtkWidget *event_box;
 	gint index, page, npages;
 	gchar *cwd = NULL; gchar *default_label_text = NULL;
+	STATS_SCOPE("sakura_new_tab");
 
 	sk_tab = g_new0(struct sakura_tab, 1);
 
@@ -3048,6 +6967,7 @@ sakura_add_tab()
 	event_box = gtk_event_box_new();
 	gtk_container_add(GTK_CONTAINER(event_box), sk_tab->label);
 	gtk_widget_set_events(event_box, GDK_BUTTON_PRESS_MASK);
+	gtk_widget_set_has_tooltip(event_box, TRUE);
 
 	/* Expand&fill the event_box to get click events all along the tab */
 	gtk_box_pack_start(GTK_BOX(tab_title_hbox), event_box, TRUE, TRUE, 0);
@@ -3081,6 +7001,13 @@ sakura_add_tab()
 
 	sk_tab->colorset = sakura.last_colorset-1;
 
+	/* Tabs executing the command line command can use their own profile */
+	if (sakura.command_profile && (option_execute || option_xterm_execute) && sakura.first_run) {
+		sk_tab->throughput = sakura.command_throughput;
+	} else {
+		sk_tab->throughput = sakura.throughput;
+	}
+
 	/* -1 if there is no pages yet */
 	page = gtk_notebook_get_current_page(GTK_NOTEBOOK(sakura.notebook));
 
@@ -3113,22 +7040,29 @@ sakura_add_tab()
 	}
 
 	gtk_notebook_set_tab_reorderable(GTK_NOTEBOOK(sakura.notebook), sk_tab->hbox, TRUE);
+	sakura_trace(TRACE_TAB_NEW, index, gtk_notebook_get_n_pages(GTK_NOTEBOOK(sakura.notebook)));
 
 	sakura_set_sktab(sakura, index, sk_tab );
 
 	/* vte signals */
+	g_signal_connect_after(G_OBJECT(sk_tab->vte), "size-allocate", G_CALLBACK(sakura_record_size_allocate_cb), sk_tab);
 	g_signal_connect(G_OBJECT(sk_tab->vte), "bell", G_CALLBACK(sakura_beep_cb), NULL);
 	g_signal_connect(G_OBJECT(sk_tab->vte), "increase-font-size", G_CALLBACK(sakura_increase_font_cb), NULL);
 	g_signal_connect(G_OBJECT(sk_tab->vte), "decrease-font-size", G_CALLBACK(sakura_decrease_font_cb), NULL);
 	sk_tab->exit_handler_id = g_signal_connect(G_OBJECT(sk_tab->vte), "child-exited", G_CALLBACK(sakura_child_exited_cb), NULL);
 	g_signal_connect(G_OBJECT(sk_tab->vte), "eof", G_CALLBACK(sakura_eof_cb), NULL);
 	g_signal_connect(G_OBJECT(sk_tab->vte), "window-title-changed", G_CALLBACK(sakura_title_changed_cb), NULL);
+	g_signal_connect(G_OBJECT(sk_tab->vte), "draw", G_CALLBACK(sakura_term_draw_cb), NULL);
+	g_signal_connect(G_OBJECT(sk_tab->vte), "hyperlink-hover-uri-changed", G_CALLBACK(sakura_hyperlink_hover_cb), NULL);
+	g_signal_connect(G_OBJECT(sk_tab->vte), "selection-changed", G_CALLBACK(sakura_selection_changed_cb), NULL);
 	g_signal_connect_after(G_OBJECT(sk_tab->vte), "button-press-event", G_CALLBACK(sakura_term_buttonpressed_cb), sakura.menu);
+	g_signal_connect(G_OBJECT(sk_tab->vte), "button-press-event", G_CALLBACK(sakura_term_selection_press_cb), NULL);
 	g_signal_connect_swapped(G_OBJECT(sk_tab->vte), "button-release-event", G_CALLBACK(sakura_term_buttonreleased_cb), sakura.menu);
 
 	/* Label & button signals */
 	/* We need the hbox to know which label/button was clicked */
 	g_signal_connect(G_OBJECT(event_box), "button_press_event", G_CALLBACK(sakura_label_clicked_cb), sk_tab->hbox);
+	g_signal_connect(G_OBJECT(event_box), "query-tooltip", G_CALLBACK(sakura_label_query_tooltip_cb), sk_tab);
 	if (sakura.show_closebutton) {
 		g_signal_connect(G_OBJECT(close_button), "clicked", G_CALLBACK(sakura_closebutton_clicked_cb), sk_tab->hbox);
 	}
@@ -3184,25 +7118,20 @@ sakura_add_tab()
 		gtk_widget_show(sakura.main_window);
 
 		sakura_set_colors();
-#ifdef GDK_WINDOWING_X11
-		/* Set WINDOWID env variable */
-		GdkDisplay *display = gdk_display_get_default();
-
-		if (GDK_IS_X11_DISPLAY (display)) {
-			GdkWindow *gwin = gtk_widget_get_window (sakura.main_window);
-			if (gwin != NULL) {
-				guint winid = gdk_x11_window_get_xid (gwin);
-				gchar *winidstr = g_strdup_printf ("%d", winid);
-				g_setenv ("WINDOWID", winidstr, FALSE);
-				g_free (winidstr);
-			}
-		}
-#endif
+		sakura_set_windowid(false);
 
 		int command_argc = 0; char **command_argv = NULL;
 
+		/* Show the standard input in the first tab, there's nothing to execute */
+		if (!spawn) {
+			/* Nothing to run, the caller feeds the tab */
+		} else if (option_stdin) {
+			GInputStream *stream = g_unix_input_stream_new(STDIN_FILENO, FALSE);
+			sakura_feed_stream(sk_tab, stream);
+			g_object_unref(stream);
+
 		/* Execute command for the fist tab if we have one */
-		if (option_execute||option_xterm_execute) {
+		} else if (option_execute||option_xterm_execute) {
 			char *path;
 
 			sakura_build_command(&command_argc, &command_argv);
@@ -3215,8 +7144,7 @@ sakura_add_tab()
 					sakura_error("%s command not found", command_argv[0]);
 					command_argc = 0;
 				}
-				vte_terminal_spawn_async(VTE_TERMINAL(sk_tab->vte), VTE_PTY_NO_HELPER, NULL, command_argv, command_env,
-						       	         G_SPAWN_SEARCH_PATH, NULL, NULL, NULL, -1, NULL, sakura_spawn_callback, sk_tab);
+				sakura_spawn(sk_tab, NULL, command_argv, command_env, G_SPAWN_SEARCH_PATH);
 
 				free(path);
 				g_strfreev(command_argv);
@@ -3224,13 +7152,12 @@ sakura_add_tab()
 		} 
 
 		/* Fork shell if there is no execute option or if the command is not valid */
-		if ( (!option_execute && !option_xterm_execute) || (command_argc==0)) {
+		if (spawn && !option_stdin && ((!option_execute && !option_xterm_execute) || (command_argc==0))) {
 			if (option_hold == TRUE) {
 				sakura_error("Hold option given without any command");
 				option_hold = FALSE;
 			}
-			vte_terminal_spawn_async(VTE_TERMINAL(sk_tab->vte), VTE_PTY_NO_HELPER, cwd, sakura.argv, command_env,
-					        G_SPAWN_SEARCH_PATH|G_SPAWN_FILE_AND_ARGV_ZERO, NULL, NULL, NULL, -1, NULL, sakura_spawn_callback, sk_tab);
+			sakura_spawn(sk_tab, cwd, sakura.argv, command_env, G_SPAWN_SEARCH_PATH|G_SPAWN_FILE_AND_ARGV_ZERO);
 		}
 
 	/********** Not the first tab ************/
@@ -3254,7 +7181,7 @@ sakura_add_tab()
 		int command_argc = 0; char **command_argv = NULL;
 
 		/* Execute command (only in the first run) for additional tabs if we have one */
-		if ((option_execute||option_xterm_execute) && sakura.first_run) {
+		if (spawn && (option_execute||option_xterm_execute) && sakura.first_run) {
 			char *path;
 
 			sakura_build_command(&command_argc, &command_argv);
@@ -3267,8 +7194,7 @@ sakura_add_tab()
 					sakura_error("%s command not found", command_argv[0]);
 					command_argc = 0;
 				}
-				vte_terminal_spawn_async(VTE_TERMINAL(sk_tab->vte), VTE_PTY_NO_HELPER, NULL, command_argv, command_env,
-						       	         G_SPAWN_SEARCH_PATH, NULL, NULL, NULL, -1, NULL, sakura_spawn_callback, sk_tab);
+				sakura_spawn(sk_tab, NULL, command_argv, command_env, G_SPAWN_SEARCH_PATH);
 
 				free(path);
 				g_strfreev(command_argv);
@@ -3276,13 +7202,12 @@ sakura_add_tab()
 		}
 
 		/* Fork shell if there is no execute option or if the command is not valid */
-		if ( (!option_execute && !option_xterm_execute) || (command_argc==0)) {
+		if (spawn && ((!option_execute && !option_xterm_execute) || (command_argc==0))) {
 			if (option_hold == TRUE) {
 				sakura_error("Hold option given without any command");
 				option_hold = FALSE;
 			}
-			vte_terminal_spawn_async(VTE_TERMINAL(sk_tab->vte), VTE_PTY_NO_HELPER, cwd, sakura.argv, command_env,
-					        G_SPAWN_SEARCH_PATH|G_SPAWN_FILE_AND_ARGV_ZERO, NULL, NULL, NULL, -1, NULL, sakura_spawn_callback, sk_tab);
+			sakura_spawn(sk_tab, cwd, sakura.argv, command_env, G_SPAWN_SEARCH_PATH|G_SPAWN_FILE_AND_ARGV_ZERO);
 		}
 	}
 
@@ -3302,15 +7227,21 @@ sakura_add_tab()
 
 	/* Init vte terminal */
 	vte_terminal_set_scrollback_lines(VTE_TERMINAL(sk_tab->vte), sakura.scroll_lines);
-	vte_terminal_match_add_regex(VTE_TERMINAL(sk_tab->vte), sakura.http_vteregexp, PCRE2_CASELESS);
-	vte_terminal_match_add_regex(VTE_TERMINAL(sk_tab->vte), sakura.mail_vteregexp, PCRE2_CASELESS);
+	/* Matching regexes is done for every updated row, so throughput tabs don't detect links. In
+	 * modifier mode, regexes are only added while the open url accelerator is held */
+	if (!sk_tab->throughput && sakura.link_detection == LINK_DETECTION_HOVER) {
+		sakura_set_link_matching(sk_tab, true);
+	}
+	vte_terminal_set_allow_hyperlink(VTE_TERMINAL(sk_tab->vte), sakura.hyperlinks ? TRUE : FALSE);
 	vte_terminal_set_mouse_autohide(VTE_TERMINAL(sk_tab->vte), TRUE);
 	vte_terminal_set_backspace_binding(VTE_TERMINAL(sk_tab->vte), VTE_ERASE_ASCII_DELETE);
 	vte_terminal_set_word_char_exceptions(VTE_TERMINAL(sk_tab->vte), sakura.word_chars);
-	vte_terminal_set_audible_bell (VTE_TERMINAL(sk_tab->vte), sakura.audible_bell ? TRUE : FALSE);
-	vte_terminal_set_cursor_blink_mode (VTE_TERMINAL(sk_tab->vte), sakura.blinking_cursor ? VTE_CURSOR_BLINK_ON : VTE_CURSOR_BLINK_OFF);
+	vte_terminal_set_audible_bell (VTE_TERMINAL(sk_tab->vte), (sakura.audible_bell && !sk_tab->throughput) ? TRUE : FALSE);
+	vte_terminal_set_cursor_blink_mode (VTE_TERMINAL(sk_tab->vte),
+	                                    (sakura.blinking_cursor && !sk_tab->throughput) ? VTE_CURSOR_BLINK_ON : VTE_CURSOR_BLINK_OFF);
 	vte_terminal_set_cursor_shape (VTE_TERMINAL(sk_tab->vte), sakura.cursor_type);
 
+	return sk_tab;
 }
 
 
@@ -3331,7 +7262,7 @@ sakura_close_tab (gint page)
 	}
 
 	/* Check if there are running processes for this tab. Use tcgetpgrp to compare to the shell PGID */
-	pgid = tcgetpgrp(vte_pty_get_fd(vte_terminal_get_pty(VTE_TERMINAL(sk_tab->vte))));
+	pgid = tcgetpgrp(sakura_tab_get_pty_fd(sk_tab));
 
 	if ( (pgid != -1) && (pgid != sk_tab->pid) && (!sakura.less_questions) ) {
 		dialog=gtk_message_dialog_new(GTK_WINDOW(sakura.main_window), GTK_DIALOG_MODAL,
@@ -3374,7 +7305,23 @@ sakura_del_tab(gint page)
 
 	gtk_widget_hide(sk_tab->hbox);
 	g_signal_handler_disconnect (sk_tab->vte, sk_tab->exit_handler_id);
+	sakura_paste_stop(sk_tab);
+	sakura_record_stop(sk_tab);
+	sakura_feed_stop(sk_tab);
+	/* Keep the CLIPBOARD contents after the terminal is gone */
+	if (sk_tab->vte == sakura.clipboard_vte) {
+		sakura_clipboard_fetch();
+		if (sakura.clipboard_text) {
+			gtk_clipboard_set_text(gtk_widget_get_clipboard(sk_tab->vte, GDK_SELECTION_CLIPBOARD),
+			                       sakura.clipboard_text, -1);
+		}
+	}
+	if (sk_tab->relay) {
+		sakura_relay_detach(sk_tab->relay);
+		sk_tab->relay = NULL;
+	}
 	gtk_notebook_remove_page(GTK_NOTEBOOK(sakura.notebook), page);
+	sakura_trace(TRACE_TAB_CLOSE, page, npages - 1);
 
 	/* Find the next page, if it exists, and grab focus */
 	if (gtk_notebook_get_n_pages(GTK_NOTEBOOK(sakura.notebook)) > 0) {
@@ -3465,6 +7412,7 @@ sakura_config_done()
 {
 	GError *gerror = NULL;
 	gsize len = 0;
+	STATS_SCOPE("sakura_config_done");
 
 	/* Don't save config file. Option only available thru the config file for users who know the risks */
 	if (sakura.dont_save)
@@ -3479,6 +7427,13 @@ sakura_config_done()
 
 	bool overwrite = false;
 
+	/* Without a file monitor (low power mode), find out external changes by the modification time */
+	if (sakura.low_power) {
+		GStatBuf cfgstat;
+		if (g_stat(sakura.configfile, &cfgstat) == 0 && cfgstat.st_mtime != sakura.config_mtime)
+			sakura.externally_modified = true;
+	}
+
 	/* If there's been changes by another sakura process, ask whether to overwrite it or not */
 	/* And if less_questions options is selected don't overwrite */
 	if (sakura.externally_modified && !sakura.config_modified && !sakura.less_questions) {
@@ -3498,6 +7453,7 @@ sakura_config_done()
 
 	/* Write to file IF there's been changes of IF we want to overwrite another process changes */
 	if (sakura.config_modified || overwrite) {
+		sakura_trace(TRACE_CONFIG_SAVE, 0, 0);
 		GIOChannel *cfgfile = g_io_channel_new_file(sakura.configfile, "w", &gerror);
 		if (!cfgfile) {
 			fprintf(stderr, "%s\n", gerror->message);
@@ -3516,6 +7472,11 @@ sakura_config_done()
 		}
 		g_io_channel_shutdown(cfgfile, TRUE, &gerror);
 		g_io_channel_unref(cfgfile);
+
+		/* Our own write is not an external change */
+		GStatBuf cfgstat;
+		if (g_stat(sakura.configfile, &cfgstat) == 0)
+			sakura.config_mtime = cfgstat.st_mtime;
 	}
 }
 
@@ -3550,61 +7511,19 @@ sakura_build_command(int *command_argc, char ***command_argv)
 {
 	GError *gerror = NULL;
 
-	if (option_execute) {
-		/* -x option: only one argument */
-		if (!g_shell_parse_argv(option_execute, command_argc, command_argv, &gerror)) {
-			switch (gerror->code) {
-			case G_SHELL_ERROR_EMPTY_STRING:
-				sakura_error("Empty exec string");
-				exit(1);
-				break;
-			case G_SHELL_ERROR_BAD_QUOTING:
-				sakura_error("Cannot parse command line arguments: mangled quoting");
-				exit(1);
-				break;
-			case G_SHELL_ERROR_FAILED:
-				sakura_error("Error in exec option command line arguments");
-				exit(1);
-			}
-			g_error_free(gerror);
-		}
-	} else {
-		/* -e option: last in the command line, takes all extra arguments */
-		if (option_xterm_args) {
-
-			guint size=0, i=0; gchar **quoted_args=NULL;
-
-			do { size++; } while (option_xterm_args[size]); /* Get option_xterm_args size */
-
-			/* Quote all arguments to be able to use parameters with spaces like filenames */
-			quoted_args = g_malloc(sizeof(char *) * (size+1));
-			while (option_xterm_args[i]) {
-				quoted_args[i] = g_shell_quote(option_xterm_args[i]); i++;
-			} 
-			quoted_args[i]=NULL;
-
-			/* Join all arguments and parse them to create argc&argv */
-			gchar *command_joined= command_joined = g_strjoinv(" ", quoted_args);
-			if (!g_shell_parse_argv(command_joined, command_argc, command_argv, &gerror)) {
-				switch (gerror->code) {
-				case G_SHELL_ERROR_EMPTY_STRING:
-					sakura_error("Empty exec string");
-					exit(1);
-					break;
-				case G_SHELL_ERROR_BAD_QUOTING:
-					sakura_error("Cannot parse command line arguments: mangled quoting");
-					exit(1);
-				case G_SHELL_ERROR_FAILED:
-					sakura_error("Error in exec option command line arguments");
-					exit(1);
-				}
-			}
-
-			if (gerror != NULL)
-				g_error_free(gerror);
-			g_free(command_joined);
-			g_strfreev(quoted_args);
+	if (!sakura_command_parse(option_execute, option_xterm_args, command_argc, command_argv, &gerror)) {
+		switch (gerror->code) {
+		case G_SHELL_ERROR_EMPTY_STRING:
+			sakura_error("Empty exec string");
+			break;
+		case G_SHELL_ERROR_BAD_QUOTING:
+			sakura_error("Cannot parse command line arguments: mangled quoting");
+			break;
+		default:
+			sakura_error("Error in exec option command line arguments");
 		}
+		g_error_free(gerror);
+		exit(1);
 	}
 }
 
@@ -3623,108 +7542,419 @@ sakura_set_keybind(const gchar *key, guint value)
 static guint
 sakura_get_keybind(const gchar *key)
 {
-	gchar *value;
-	guint retval = GDK_KEY_VoidSymbol;
+	return sakura_config_get_keybind(sakura.cfg, cfg_group, key);
+}
+
+
+/* Legacy function to use as fallback if our shell doesn't emit OSC7 */
+static char *
+sakura_get_term_cwd(struct sakura_tab* sk_tab)
+{
+	return sakura_pid_cwd(sk_tab->pid);
+}
+
+
+static char *
+sakura_get_term_cwd_osc7(struct sakura_tab* sk_tab)
+{
+	return sakura_osc7_cwd(vte_terminal_get_current_directory_uri(VTE_TERMINAL(sk_tab->vte)));
+}
+
+
+static guint
+sakura_tokeycode (guint key)
+{
+	return sakura_keyval_to_keycode(gdk_keymap_get_for_display(gdk_display_get_default()), key);
+}
+
+
+/* Wrapper for the glib poll function, used to count wakeups by file descriptor.
+ * Only counts here, names are resolved when the report is printed */
+static gint
+sakura_wakeup_poll (GPollFD *ufds, guint nfds, gint timeout)
+{
+	gint ret, key;
+	guint i;
+
+	ret = sakura.default_poll(ufds, nfds, timeout);
+
+	if (ret < 0) return ret;
 
-	value = g_key_file_get_string(sakura.cfg, cfg_group, key, NULL);
-	if (value != NULL) {
-		retval = gdk_keyval_from_name(value);
-		g_free(value);
+	sakura.wakeups_total++;
+	for (i=0; i<nfds; i++) {
+		if (ret == 0 || ufds[i].revents) {
+			/* Key 0 is used for timeouts, fds use fd+1 */
+			key = (ret == 0) ? 0 : ufds[i].fd + 1;
+			guint count = GPOINTER_TO_UINT(g_hash_table_lookup(sakura.wakeups, GINT_TO_POINTER(key)));
+			g_hash_table_insert(sakura.wakeups, GINT_TO_POINTER(key), GUINT_TO_POINTER(count+1));
+			if (ret == 0) break;
+		}
 	}
 
-	/* For backwards compatibility with integer values */
-	/* If gdk_keyval_from_name fail, it seems to be integer value*/
-	if ((retval == GDK_KEY_VoidSymbol) || (retval == 0)) {
-		retval = g_key_file_get_integer(sakura.cfg, cfg_group, key, NULL);
+	return ret;
+}
+
+
+/* Get a readable name for a file descriptor polled by the main loop */
+static gchar *
+sakura_wakeup_fd_name (gint fd)
+{
+	struct sakura_tab *sk_tab;
+	gint i, n_pages;
+	gchar *path, *name;
+
+#ifdef GDK_WINDOWING_X11
+	GdkDisplay *display = gdk_display_get_default();
+	if (GDK_IS_X11_DISPLAY(display) && fd == ConnectionNumber(GDK_DISPLAY_XDISPLAY(display)))
+		return g_strdup("X11 events");
+#endif
+
+	n_pages = gtk_notebook_get_n_pages(GTK_NOTEBOOK(sakura.notebook));
+	for (i=0; i<n_pages; i++) {
+		sk_tab = sakura_get_sktab(sakura, i);
+		if (sakura_tab_get_pty_fd(sk_tab) == fd)
+			return g_strdup_printf("pty (tab %d)", i+1);
 	}
 
-	/* Always use uppercase value as keyval */
-	return gdk_keyval_to_upper(retval);
+	path = g_strdup_printf("/proc/self/fd/%d", fd);
+	name = g_file_read_link(path, NULL);
+	g_free(path);
+
+	return name ? name : g_strdup_printf("fd %d", fd);
 }
 
 
-/* Legacy function to use as fallback if our shell doesn't emit OSC7.
- * Retrieves the CWD of the specified sk_tab page.Original borrowed 
- * from gnome-terminal. Adapted by Hong Jen Yee and David Gómez */
-static char *
-sakura_get_term_cwd(struct sakura_tab* sk_tab)
+/* Print wakeups of the last interval grouped by source, and reset the counters */
+static void
+sakura_wakeup_report (void)
 {
-	char *cwd = NULL;
+	GHashTable *by_name;
+	GHashTableIter iter;
+	gpointer key, value;
+	GString *report;
 
-	if (sk_tab->pid >= 0) {
-		char *file, *buf;
-		struct stat sb;
-		int len;
+	by_name = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
 
-		file = g_strdup_printf ("/proc/%d/cwd", sk_tab->pid);
+	g_hash_table_iter_init(&iter, sakura.wakeups);
+	while (g_hash_table_iter_next(&iter, &key, &value)) {
+		gint fd = GPOINTER_TO_INT(key) - 1;
+		gchar *name = (fd < 0) ? g_strdup("timeout") : sakura_wakeup_fd_name(fd);
+		guint count = GPOINTER_TO_UINT(g_hash_table_lookup(by_name, name)) + GPOINTER_TO_UINT(value);
+		g_hash_table_replace(by_name, name, GUINT_TO_POINTER(count));
+	}
 
-		if (g_stat(file, &sb) == -1) {
-			g_free(file);
-			return cwd;
-		}
+	report = g_string_new(NULL);
+	g_string_printf(report, "wakeups/s: %u", sakura.wakeups_total / HOUSEKEEPING_INTERVAL);
+	g_hash_table_iter_init(&iter, by_name);
+	while (g_hash_table_iter_next(&iter, &key, &value)) {
+		g_string_append_printf(report, " | %s: %u", (gchar *)key, GPOINTER_TO_UINT(value) / HOUSEKEEPING_INTERVAL);
+	}
+	fprintf(stderr, "%s\n", report->str);
 
-		buf = g_malloc(sb.st_size + 1);
+	g_string_free(report, TRUE);
+	g_hash_table_destroy(by_name);
+	g_hash_table_remove_all(sakura.wakeups);
+	sakura.wakeups_total = 0;
+}
 
-		if (buf == NULL) {
-			g_free(file);
-			return cwd;
-		}
 
-		len = readlink(file, buf, sb.st_size + 1);
+/* Print the time since the start of main when a startup phase ends. Phases are printed only once */
+static void
+sakura_startup_trace (StartupPhase phase)
+{
+	char buffer[G_ASCII_DTOSTR_BUF_SIZE];
+
+	if (!option_startup_trace || (sakura.startup_traced & (1 << phase)))
+		return;
+
+	/* Always with a decimal point, it's read by scripts */
+	sakura.startup_traced |= 1 << phase;
+	g_ascii_formatd(buffer, sizeof(buffer), "%.3f", (g_get_monotonic_time() - sakura.startup_time) / 1000.0);
+	fprintf(stderr, "startup: %-10s %9s ms\n", startup_phase_names[phase], buffer);
+}
+
+
+static gboolean
+sakura_startup_map_cb (GtkWidget *widget, GdkEvent *event, gpointer data)
+{
+	sakura_startup_trace(STARTUP_MAP);
+	g_signal_handlers_disconnect_by_func(widget, sakura_startup_map_cb, data);
+
+	return FALSE;
+}
+
+
+static void
+sakura_startup_output_cb (VteTerminal *vte, gpointer data)
+{
+	sakura_startup_trace(STARTUP_OUTPUT);
+	g_signal_handlers_disconnect_by_func(vte, sakura_startup_output_cb, data);
+}
 
-		if (len > 0 && buf[0] == '/') {
-			buf[len] = '\0';
-			cwd = g_strdup(buf);
-		}
 
-		g_free(buf);
-		g_free(file);
+/* Called after each initial tab is opened, the first one that could be opened ends the phase */
+static void
+sakura_startup_tab_added (void)
+{
+	if (gtk_notebook_get_n_pages(GTK_NOTEBOOK(sakura.notebook)) > 0)
+		sakura_startup_trace(STARTUP_FIRST_TAB);
+}
+
+
+/* Handler by name. The names come from the macro arguments, like G_CALLBACK(name) */
+static struct sakura_callback *
+sakura_callback_get (const char *macro_arg)
+{
+	struct sakura_callback *callback;
+	const char *start, *end;
+	gchar *name;
+
+	start = strrchr(macro_arg, '(') ? strrchr(macro_arg, '(') + 1 : macro_arg;
+	while (g_ascii_isspace(*start)) start++;
+	for (end = start; g_ascii_isalnum(*end) || *end == '_'; end++);
+	name = g_strndup(start, end - start);
+
+	if (!callbacks)
+		callbacks = g_hash_table_new(g_str_hash, g_str_equal);
+
+	if ((callback = g_hash_table_lookup(callbacks, name))) {
+		g_free(name);
+		return callback;
 	}
 
-	return cwd;
+	callback = g_new0(struct sakura_callback, 1);
+	callback->name = name;
+#ifdef SAKURA_CALLBACK_STATS
+	callback->stats = sakura_stats_get(name);
+#endif
+	g_hash_table_insert(callbacks, name, callback);
+
+	return callback;
 }
 
 
-static char *
-sakura_get_term_cwd_osc7(struct sakura_tab* sk_tab)
+static void
+sakura_callback_pre (gpointer data, GClosure *closure)
 {
-	gchar *cwd = NULL; gchar *osc7_hostname = NULL; 
-	const char *osc7_uri = NULL; const char *hostname = NULL;
+	struct sakura_callback *callback = (struct sakura_callback *) data;
+
+	if (callback_depth < CALLBACK_MAX_DEPTH) {
+		callback_names[callback_depth] = callback_current;
+#ifdef SAKURA_CALLBACK_STATS
+		callback_starts[callback_depth] = g_get_monotonic_time();
+#endif
+	}
+	callback_depth++;
+	callback_current = callback->name;
+}
+
 
-	osc7_uri = vte_terminal_get_current_directory_uri(VTE_TERMINAL(sk_tab->vte));
+static void
+sakura_callback_post (gpointer data, GClosure *closure)
+{
+	struct sakura_callback *callback = (struct sakura_callback *) data;
 
-	if (osc7_uri) {
-		cwd = g_filename_from_uri(osc7_uri, &osc7_hostname, NULL);
-		/* Check if the hostname matchs. If not, return NULL */
-		hostname = g_get_host_name();
-		if ((strcmp(osc7_hostname, hostname) != 0) || (strcmp(osc7_hostname, "localhost") == 0)) cwd = NULL;
+	callback_depth--;
+	if (callback_depth < CALLBACK_MAX_DEPTH) {
+		callback_current = callback_names[callback_depth];
+#ifdef SAKURA_CALLBACK_STATS
+		sakura_stats_record(callback->stats, g_get_monotonic_time() - callback_starts[callback_depth]);
+#endif
 	}
+}
+
+
+/* g_signal_connect* replacement, the handler is called between the closure guards. Without
+ * the watchdog and the statistics it's connected as usual */
+static gulong
+sakura_connect (gpointer instance, const gchar *signal, GCallback handler, gpointer data, const char *name, GConnectFlags flags)
+{
+	struct sakura_callback *callback;
+	GClosure *closure;
+
+#ifndef SAKURA_CALLBACK_STATS
+	if (sakura.watchdog_threshold <= 0)
+		return g_signal_connect_data(instance, signal, handler, data, NULL, flags);
+#endif
+
+	callback = sakura_callback_get(name);
+	closure = (flags & G_CONNECT_SWAPPED) ? g_cclosure_new_swap(handler, data, NULL) : g_cclosure_new(handler, data, NULL);
+	g_closure_add_marshal_guards(closure, callback, sakura_callback_pre, callback, sakura_callback_post);
+
+	return g_signal_connect_closure(instance, signal, closure, (flags & G_CONNECT_AFTER) != 0);
+}
 
-	return cwd;
+
+#ifdef SAKURA_CALLBACK_STATS
+static GHashTable *stats_table;
+
+
+/* Histogram by name, given by sakura_callback_get or STATS_SCOPE */
+static struct sakura_stats *
+sakura_stats_get (const char *name)
+{
+	struct sakura_stats *stats;
+
+	if (!stats_table)
+		stats_table = g_hash_table_new(g_str_hash, g_str_equal);
+
+	if ((stats = g_hash_table_lookup(stats_table, name)))
+		return stats;
+
+	stats = g_new0(struct sakura_stats, 1);
+	stats->name = g_strdup(name);
+	g_hash_table_insert(stats_table, (gpointer) stats->name, stats);
+
+	return stats;
 }
 
 
 static guint
-sakura_tokeycode (guint key)
+sakura_stats_bucket (guint64 value)
 {
-	GdkKeymap *keymap;
-	GdkKeymapKey *keys;
-	gint n_keys;
-	guint res = 0;
+	guint msb, shift;
+
+	if (value < (1 << STATS_SUB_BITS))
+		return value;
 
-	keymap = gdk_keymap_get_for_display(gdk_display_get_default());
+	msb = 63 - __builtin_clzll(value);
+	shift = msb - STATS_SUB_BITS;
+	return ((shift + 1) << STATS_SUB_BITS) + ((value >> shift) & ((1 << STATS_SUB_BITS) - 1));
+}
 
-	/* Empty shortcut */
-	if (key == 0) return 0;
 
-	if (gdk_keymap_get_entries_for_keyval(keymap, key, &keys, &n_keys)) {
-		if (n_keys > 0) {
-			res = keys[0].keycode;
-		}
-		g_free(keys);
+/* Highest value counted in a bucket */
+static guint64
+sakura_stats_bucket_value (guint bucket)
+{
+	guint shift;
+
+	if (bucket < (1 << STATS_SUB_BITS))
+		return bucket;
+
+	shift = (bucket >> STATS_SUB_BITS) - 1;
+	return ((((guint64) (1 << STATS_SUB_BITS) | (bucket & ((1 << STATS_SUB_BITS) - 1))) + 1) << shift) - 1;
+}
+
+
+static void
+sakura_stats_record (struct sakura_stats *stats, gint64 duration)
+{
+	guint64 value = duration > 0 ? duration : 0;
+
+	stats->count++;
+	stats->total += value;
+	stats->max = MAX(stats->max, value);
+	stats->buckets[sakura_stats_bucket(value)]++;
+}
+
+
+static void
+sakura_stats_scope_end (struct sakura_stats_scope *scope)
+{
+	sakura_stats_record(scope->stats, g_get_monotonic_time() - scope->start);
+}
+
+
+static guint64
+sakura_stats_percentile (struct sakura_stats *stats, double percentile)
+{
+	guint64 target, seen = 0;
+	guint i;
+
+	target = (guint64) ceil(percentile * stats->count);
+	for (i = 0; i < STATS_BUCKETS; i++) {
+		seen += stats->buckets[i];
+		if (seen >= target && seen > 0)
+			return MIN(sakura_stats_bucket_value(i), stats->max);
+	}
+
+	return stats->max;
+}
+
+
+static gint
+sakura_stats_compare (gconstpointer a, gconstpointer b)
+{
+	const struct sakura_stats *sa = *(const struct sakura_stats **) a;
+	const struct sakura_stats *sb = *(const struct sakura_stats **) b;
+
+	return sa->total < sb->total ? 1 : sa->total > sb->total ? -1 : 0;
+}
+
+
+/* Print the callbacks that have been called, the most expensive first. Times in microseconds */
+static void
+sakura_stats_dump (void)
+{
+	GPtrArray *sorted;
+	GHashTableIter iter;
+	gpointer value;
+	struct sakura_stats *stats;
+	guint i;
+
+	if (!stats_table)
+		return;
+
+	sorted = g_ptr_array_new();
+	g_hash_table_iter_init(&iter, stats_table);
+	while (g_hash_table_iter_next(&iter, NULL, &value)) {
+		if (((struct sakura_stats *) value)->count > 0)
+			g_ptr_array_add(sorted, value);
+	}
+	g_ptr_array_sort(sorted, sakura_stats_compare);
+
+	fprintf(stderr, "callbacks: %-36s %10s %12s %8s %8s %8s %8s %8s\n",
+	        "name", "calls", "total", "mean", "p50", "p90", "p99", "max");
+	for (i = 0; i < sorted->len; i++) {
+		stats = g_ptr_array_index(sorted, i);
+		fprintf(stderr, "callbacks: %-36s %10" G_GUINT64_FORMAT " %12" G_GUINT64_FORMAT " %8" G_GUINT64_FORMAT
+		        " %8" G_GUINT64_FORMAT " %8" G_GUINT64_FORMAT " %8" G_GUINT64_FORMAT " %8" G_GUINT64_FORMAT "\n",
+		        stats->name, stats->count, stats->total, stats->total / stats->count,
+		        sakura_stats_percentile(stats, 0.50), sakura_stats_percentile(stats, 0.90),
+		        sakura_stats_percentile(stats, 0.99), stats->max);
+	}
+
+	g_ptr_array_free(sorted, TRUE);
+}
+#endif
+
+
+/* Periodic housekeeping. All periodic work is done here, so sakura wakes up at most once
+ * per interval. g_timeout_add_seconds also aligns us with the timers of other processes */
+static gboolean
+sakura_housekeeping_cb (gpointer data)
+{
+	if (option_wakeup_stats) {
+		sakura_wakeup_report();
 	}
 
-	return res;
+	return G_SOURCE_CONTINUE;
+}
+
+
+/* Get the modifier mask set by a modifier key, or 0 for other keys */
+static GdkModifierType
+sakura_keyval_to_modifier (guint keyval)
+{
+	switch (keyval) {
+		case GDK_KEY_Control_L:
+		case GDK_KEY_Control_R:
+			return GDK_CONTROL_MASK;
+		case GDK_KEY_Shift_L:
+		case GDK_KEY_Shift_R:
+			return GDK_SHIFT_MASK;
+		case GDK_KEY_Alt_L:
+		case GDK_KEY_Alt_R:
+		case GDK_KEY_Meta_L:
+		case GDK_KEY_Meta_R:
+			return GDK_MOD1_MASK;
+		case GDK_KEY_Super_L:
+		case GDK_KEY_Super_R:
+			return GDK_SUPER_MASK|GDK_MOD4_MASK;
+		default:
+			return 0;
+	}
 }
 
 
@@ -3750,6 +7980,8 @@ sakura_sanitize_working_directory()
 /* main */
 /********/
 
+/* The benchmarks include this file and have their own main */
+#ifndef SAKURA_BENCH
 int
 main(int argc, char **argv)
 {
@@ -3758,6 +7990,9 @@ main(int argc, char **argv)
 	char **nargv; int nargc;
 	gboolean have_e;
 
+	sakura.startup_time = g_get_monotonic_time();
+	sakura_trace_init();
+
 	/* Localization */
 	setlocale(LC_ALL, "");
 	localedir = g_strdup_printf("%s/locale", DATADIR);
@@ -3807,6 +8042,7 @@ main(int argc, char **argv)
 	}
 
 	g_option_context_free(context);
+	sakura_startup_trace(STARTUP_OPTIONS);
 
 	if (option_workdir && chdir(option_workdir)) {
 		fprintf(stderr, _("Cannot change working directory\n"));
@@ -3823,12 +8059,58 @@ main(int argc, char **argv)
 	}
 
 	/* Init stuff */
+	sakura_load_config();
+	sakura_startup_trace(STARTUP_CONFIG);
+
+	/* Accessibility support is expensive for fast scrolling terminals. The bridge can't
+	 * be disabled per widget, so only when all the tabs use the throughput profile. It
+	 * must be disabled before gtk_init, and unset after it so our children don't inherit it */
+	bool no_at_bridge = sakura.throughput && (!sakura.command_profile || sakura.command_throughput) &&
+	                    !g_getenv("NO_AT_BRIDGE");
+	if (no_at_bridge) {
+		g_setenv("NO_AT_BRIDGE", "1", TRUE);
+	}
+
 	gtk_init(&nargc, &nargv); g_strfreev(nargv);
+	if (no_at_bridge) {
+		g_unsetenv("NO_AT_BRIDGE");
+	}
+	sakura_startup_trace(STARTUP_GTK_INIT);
 	sakura_init();
 
-	/* Add initial tabs (1 by default) */
-	for (i=0; i<option_ntabs; i++)
-		sakura_add_tab();
+	/* Add initial tabs (1 by default), or the ones following files and attached to consoles */
+	if (option_tail || option_serial || option_socket) {
+		for (i=0; option_tail && option_tail[i]; i++) {
+			sakura_tail_file(option_tail[i]);
+			sakura_startup_tab_added();
+		}
+		for (i=0; option_serial && option_serial[i]; i++) {
+			sakura_serial_tab(option_serial[i]);
+			sakura_startup_tab_added();
+		}
+		for (i=0; option_socket && option_socket[i]; i++) {
+			sakura_socket_tab(option_socket[i]);
+			sakura_startup_tab_added();
+		}
+		g_strfreev(option_tail);
+		g_strfreev(option_serial);
+		g_strfreev(option_socket);
+
+		/* Nothing could be opened */
+		if (gtk_notebook_get_n_pages(GTK_NOTEBOOK(sakura.notebook)) == 0)
+			exit(1);
+	} else {
+		for (i=0; i<option_ntabs; i++) {
+			sakura_add_tab();
+			sakura_startup_tab_added();
+		}
+	}
+
+	/* The first output shown, usually the shell prompt, ends the startup */
+	if (option_startup_trace) {
+		struct sakura_tab *sk_tab = sakura_get_sktab(sakura, 0);
+		g_signal_connect(G_OBJECT(sk_tab->vte), "contents-changed", G_CALLBACK(sakura_startup_output_cb), NULL);
+	}
 
 	/* Post init stuff */
 	sakura.first_run=false;
@@ -3838,6 +8120,10 @@ main(int argc, char **argv)
 
 	gtk_main();
 
+	/* Write what is left of the recordings */
+	sakura_recorders_wait();
+
 	return 0;
 }
+#endif
 
@@ -0,0 +1,220 @@
+/*******************************************************************************
+ *  Filename: test-libsakura.c
+ *  Description: Unit tests for the libsakura helpers
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ *****************************************************************************/
+
+/* Run with "make test" or ctest. No display is needed */
+
+#include <string.h>
+#include <glib.h>
+#include <gdk/gdk.h>
+#include "../src/libsakura.h"
+
+
+static void
+test_tab_title_pad (void)
+{
+	gchar *label;
+
+	label = sakura_tab_title("vim", 1);
+	g_assert_cmpstr(label, ==, "vim   ");
+	g_assert_cmpuint(strlen(label), ==, TAB_MIN_SIZE);
+	g_free(label);
+
+	label = sakura_tab_title("make install", 1);
+	g_assert_cmpstr(label, ==, "make install");
+	g_free(label);
+}
+
+
+static void
+test_tab_title_chop (void)
+{
+	gchar *title, *label;
+
+	title = g_strnfill(TAB_MAX_SIZE + 10, 'x');
+	label = sakura_tab_title(title, 1);
+	g_assert_cmpuint(strlen(label), ==, TAB_MAX_SIZE);
+	g_assert_true(strncmp(label, title, TAB_MAX_SIZE) == 0);
+	g_free(label);
+	g_free(title);
+}
+
+
+static void
+test_tab_title_default (void)
+{
+	gchar *label;
+
+	label = sakura_tab_title(NULL, 3);
+	g_assert_cmpstr(label, ==, "Terminal 3");
+	g_free(label);
+
+	label = sakura_tab_title("", 4);
+	g_assert_cmpstr(label, ==, "Terminal 4");
+	g_free(label);
+}
+
+
+static void
+test_command_parse_execute (void)
+{
+	char **argv = NULL;
+	int argc = 0;
+
+	g_assert_true(sakura_command_parse("vim 'some file.c'", NULL, &argc, &argv, NULL));
+	g_assert_cmpint(argc, ==, 2);
+	g_assert_cmpstr(argv[0], ==, "vim");
+	g_assert_cmpstr(argv[1], ==, "some file.c");
+	g_assert_null(argv[2]);
+	g_strfreev(argv);
+}
+
+
+static void
+test_command_parse_xterm_args (void)
+{
+	char *xterm_args[] = { "vim", "-c", "set ft=c", "some 'file'.c", NULL };
+	char **argv = NULL;
+	int argc = 0;
+
+	/* Each argument is kept as it is, spaces and quotes included */
+	g_assert_true(sakura_command_parse(NULL, xterm_args, &argc, &argv, NULL));
+	g_assert_cmpint(argc, ==, 4);
+	g_assert_cmpstr(argv[0], ==, "vim");
+	g_assert_cmpstr(argv[1], ==, "-c");
+	g_assert_cmpstr(argv[2], ==, "set ft=c");
+	g_assert_cmpstr(argv[3], ==, "some 'file'.c");
+	g_strfreev(argv);
+}
+
+
+static void
+test_command_parse_none (void)
+{
+	char **argv = NULL;
+	int argc = -1;
+	GError *error = NULL;
+
+	/* No command, argc and argv are untouched */
+	g_assert_true(sakura_command_parse(NULL, NULL, &argc, &argv, NULL));
+	g_assert_cmpint(argc, ==, -1);
+	g_assert_null(argv);
+
+	g_assert_false(sakura_command_parse("vim 'some file.c", NULL, &argc, &argv, &error));
+	g_assert_error(error, G_SHELL_ERROR, G_SHELL_ERROR_BAD_QUOTING);
+	g_error_free(error);
+}
+
+
+static void
+test_osc7_cwd_this_host (void)
+{
+	gchar *uri, *cwd;
+	const char *hostname = g_get_host_name();
+
+	/* URIs from localhost are rejected, see below */
+	if (g_strcmp0(hostname, "localhost") == 0) {
+		g_test_skip("The host name is localhost");
+		return;
+	}
+
+	uri = g_strdup_printf("file://%s/tmp/some%%20dir", hostname);
+	cwd = sakura_osc7_cwd(uri);
+	g_assert_cmpstr(cwd, ==, "/tmp/some dir");
+	g_free(cwd);
+	g_free(uri);
+}
+
+
+static void
+test_osc7_cwd_other_host (void)
+{
+	g_assert_null(sakura_osc7_cwd("file://sakura-test-other-host.invalid/tmp"));
+}
+
+
+static void
+test_osc7_cwd_no_host (void)
+{
+	/* Without a host name it can't be told where the directory is */
+	g_assert_null(sakura_osc7_cwd("file:///tmp"));
+	g_assert_null(sakura_osc7_cwd(NULL));
+}
+
+
+static void
+test_osc7_cwd_localhost (void)
+{
+	g_assert_null(sakura_osc7_cwd("file://localhost/tmp"));
+}
+
+
+static void
+test_config_keybind (void)
+{
+	GKeyFile *cfg = g_key_file_new();
+
+	g_key_file_set_string(cfg, "sakura", "copy_key", "C");
+	g_key_file_set_string(cfg, "sakura", "paste_key", "v");
+	g_assert_cmpuint(sakura_config_get_keybind(cfg, "sakura", "copy_key"), ==, GDK_KEY_C);
+	g_assert_cmpuint(sakura_config_get_keybind(cfg, "sakura", "paste_key"), ==, GDK_KEY_V);
+
+	/* A missing key is an empty shortcut */
+	g_assert_cmpuint(sakura_config_get_keybind(cfg, "sakura", "missing_key"), ==, 0);
+
+	g_key_file_free(cfg);
+}
+
+
+static void
+test_config_keybind_legacy (void)
+{
+	GKeyFile *cfg = g_key_file_new();
+
+	/* Older configuration files have the keyval, always used in uppercase */
+	g_key_file_set_integer(cfg, "sakura", "copy_key", GDK_KEY_C);
+	g_key_file_set_integer(cfg, "sakura", "paste_key", GDK_KEY_v);
+	g_key_file_set_integer(cfg, "sakura", "fullscreen_key", GDK_KEY_F11);
+	g_assert_cmpuint(sakura_config_get_keybind(cfg, "sakura", "copy_key"), ==, GDK_KEY_C);
+	g_assert_cmpuint(sakura_config_get_keybind(cfg, "sakura", "paste_key"), ==, GDK_KEY_V);
+	g_assert_cmpuint(sakura_config_get_keybind(cfg, "sakura", "fullscreen_key"), ==, GDK_KEY_F11);
+
+	g_key_file_free(cfg);
+}
+
+
+int
+main (int argc, char **argv)
+{
+	g_test_init(&argc, &argv, NULL);
+
+	g_test_add_func("/tab-title/pad", test_tab_title_pad);
+	g_test_add_func("/tab-title/chop", test_tab_title_chop);
+	g_test_add_func("/tab-title/default", test_tab_title_default);
+	g_test_add_func("/command-parse/execute", test_command_parse_execute);
+	g_test_add_func("/command-parse/xterm-args", test_command_parse_xterm_args);
+	g_test_add_func("/command-parse/none", test_command_parse_none);
+	g_test_add_func("/osc7-cwd/this-host", test_osc7_cwd_this_host);
+	g_test_add_func("/osc7-cwd/other-host", test_osc7_cwd_other_host);
+	g_test_add_func("/osc7-cwd/no-host", test_osc7_cwd_no_host);
+	g_test_add_func("/osc7-cwd/localhost", test_osc7_cwd_localhost);
+	g_test_add_func("/config/keybind", test_config_keybind);
+	g_test_add_func("/config/keybind-legacy", test_config_keybind_legacy);
+
+	return g_test_run();
+}